@@ -0,0 +1,192 @@
+/*
+ * ivf.c - Índice IVF (listas invertidas) de embedding::store
+ * - k-means esférico sobre una muestra de filas: centroides de norma 1, la
+ *   similitud con un centroide es un producto punto
+ * - Cada fila va a la lista de su centroide más cercano; las filas que se
+ *   agregan después del entrenamiento se asignan al insertarlas
+ * - Una búsqueda sondea solo las nprobe listas más cercanas a la consulta
+ * - Ivf_Order da un orden de filas con localidad para embedding::store reorder
+ */
+
+#include "tclembeddingInt.h"
+#include <math.h>
+#include <string.h>
+
+// xorshift64: muestreo reproducible sin tocar rand()
+static uint64_t NextRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void Normalize(float *v, int dim) {
+    float norm = sqrtf(Vec_Dot(v, v, dim));
+    if (norm > 0.0f) {
+        float scale = 1.0f / norm;
+        for (int i = 0; i < dim; i++) v[i] *= scale;
+    }
+}
+
+static int NearestIn(const float *centroids, int nlist, int dim, const float *vec, float *scorePtr) {
+    VecDotProc *dot = Vec_DotFor(dim);
+    int best = 0;
+    float best_score = -INFINITY;
+    for (int c = 0; c < nlist; c++) {
+        float score = dot(vec, centroids + (size_t)c * dim, dim);
+        if (score > best_score) {
+            best_score = score;
+            best = c;
+        }
+    }
+    if (scorePtr) *scorePtr = best_score;
+    return best;
+}
+
+int Ivf_Nearest(const VectorStore *store, const float *vec) {
+    return NearestIn(store->centroids, store->nlist, store->dim, vec, NULL);
+}
+
+void Ivf_Free(VectorStore *store) {
+    if (store->nlist == 0) return;
+    for (int c = 0; c < store->nlist; c++) ckfree((char *)store->lists[c].rows);
+    ckfree((char *)store->lists);
+    ckfree((char *)store->centroids);
+    Memory_Release(&store->mem, (size_t)store->nlist * store->dim * sizeof(float));
+    store->lists = NULL;
+    store->centroids = NULL;
+    store->nlist = 0;
+    store->nprobe = 0;
+}
+
+// Entrena nlist centroides con `iterations` pasadas de k-means sobre
+// `sample` filas y reparte todo el almacén en listas. Reemplaza el índice
+// anterior solo si el nuevo se construyó completo.
+int Ivf_Build(Tcl_Interp *interp, VectorStore *store, int nlist, int iterations, Tcl_Size sample) {
+    int dim = store->dim;
+    if ((Tcl_Size)nlist > store->count) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("store has %" TCL_SIZE_MODIFIER "d rows, need at least %d for %d lists",
+                                               store->count, nlist, nlist));
+        return TCL_ERROR;
+    }
+    if (sample < nlist) sample = nlist;
+    if (sample > store->count) sample = store->count;
+
+    // El índice viejo sigue contabilizado hasta que se libere
+    size_t bytes = (size_t)nlist * dim * sizeof(float);
+    if (Memory_ReserveOrError(interp, &store->mem, bytes) != TCL_OK) return TCL_ERROR;
+
+    // Muestra: Fisher-Yates parcial sobre los números de fila
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    Tcl_Size *rows = (Tcl_Size *) ckalloc(sizeof(Tcl_Size) * store->count);
+    for (Tcl_Size r = 0; r < store->count; r++) rows[r] = r;
+    for (Tcl_Size i = 0; i < sample; i++) {
+        Tcl_Size j = i + (Tcl_Size)(NextRandom(&seed) % (uint64_t)(store->count - i));
+        Tcl_Size t = rows[i]; rows[i] = rows[j]; rows[j] = t;
+    }
+
+    // Centroides iniciales: las primeras nlist filas de la muestra
+    // Con -layout blocked las filas se copian a `scratch` para leerlas
+    float *scratch = (float *) ckalloc(sizeof(float) * dim);
+    float *centroids = (float *) ckalloc(bytes);
+    for (int c = 0; c < nlist; c++) {
+        memcpy(centroids + (size_t)c * dim, Store_Row(store, rows[c], scratch), dim * sizeof(float));
+    }
+
+    float *sums = (float *) ckalloc(bytes);
+    Tcl_Size *sizes = (Tcl_Size *) ckalloc(sizeof(Tcl_Size) * nlist);
+    for (int it = 0; it < iterations; it++) {
+        memset(sums, 0, bytes);
+        memset(sizes, 0, sizeof(Tcl_Size) * nlist);
+        for (Tcl_Size i = 0; i < sample; i++) {
+            const float *vec = Store_Row(store, rows[i], scratch);
+            int c = NearestIn(centroids, nlist, dim, vec, NULL);
+            Vec_Axpy(sums + (size_t)c * dim, 1.0f, vec, dim);
+            sizes[c]++;
+        }
+        for (int c = 0; c < nlist; c++) {
+            float *centroid = centroids + (size_t)c * dim;
+            if (sizes[c] == 0) {
+                // Lista vacía: se resiembra con una fila al azar de la muestra
+                Tcl_Size pick = rows[NextRandom(&seed) % (uint64_t)sample];
+                memcpy(centroid, Store_Row(store, pick, scratch), dim * sizeof(float));
+                continue;
+            }
+            memcpy(centroid, sums + (size_t)c * dim, dim * sizeof(float));
+            Normalize(centroid, dim);
+        }
+    }
+    ckfree((char *)sizes);
+    ckfree((char *)sums);
+    ckfree((char *)rows);
+
+    RowList *lists = (RowList *) ckalloc(sizeof(RowList) * nlist);
+    memset(lists, 0, sizeof(RowList) * nlist);
+    for (Tcl_Size r = 0; r < store->count; r++) {
+        int c = NearestIn(centroids, nlist, dim, Store_Row(store, r, scratch), NULL);
+        RowList_Push(&lists[c], r);
+    }
+    ckfree((char *)scratch);
+
+    Ivf_Free(store);
+    store->nlist = nlist;
+    store->nprobe = nlist >= 16 ? nlist / 16 : 1;
+    store->centroids = centroids;
+    store->lists = lists;
+    return TCL_OK;
+}
+
+// Las nprobe listas más cercanas a la consulta, de mejor a peor
+int Ivf_Probe(const VectorStore *store, const float *query, int nprobe, int *lists) {
+    if (nprobe > store->nlist) nprobe = store->nlist;
+    float *scores = (float *) ckalloc(sizeof(float) * (nprobe ? nprobe : 1));
+    int n = 0;
+    for (int c = 0; c < store->nlist; c++) {
+        float score = store->dot(query, store->centroids + (size_t)c * store->dim, store->dim);
+        if (n == nprobe && score <= scores[n - 1]) continue;
+        // Inserción ordenada: nprobe es chico frente a nlist
+        int i = (n < nprobe) ? n++ : n - 1;
+        while (i > 0 && scores[i - 1] < score) {
+            scores[i] = scores[i - 1];
+            lists[i] = lists[i - 1];
+            i--;
+        }
+        scores[i] = score;
+        lists[i] = c;
+    }
+    ckfree((char *)scores);
+    return n;
+}
+
+// Orden de filas con localidad: las filas de cada lista quedan contiguas y
+// cada lista va seguida de la no visitada con el centroide más parecido
+// (recorrido voraz sobre el grafo de centroides, como un BFS que siempre
+// toma el vecino más cercano). Las listas que sondea una misma consulta
+// son vecinas, así que sus filas quedan cerca en memoria.
+// order[i] = fila actual que pasa a ser la fila i; cubre todas las filas.
+void Ivf_Order(const VectorStore *store, Tcl_Size *order) {
+    int nlist = store->nlist, dim = store->dim;
+    unsigned char *visited = (unsigned char *) ckalloc(nlist);
+    memset(visited, 0, nlist);
+    Tcl_Size next = 0;
+    for (int c = 0; c >= 0; ) {
+        const RowList *list = &store->lists[c];
+        memcpy(order + next, list->rows, sizeof(Tcl_Size) * list->count);
+        next += list->count;
+        visited[c] = 1;
+
+        const float *centroid = store->centroids + (size_t)c * dim;
+        float best_score = -INFINITY;
+        c = -1;
+        for (int o = 0; o < nlist; o++) {
+            if (visited[o]) continue;
+            float score = store->dot(centroid, store->centroids + (size_t)o * dim, dim);
+            if (c < 0 || score > best_score) {
+                best_score = score;
+                c = o;
+            }
+        }
+    }
+    ckfree((char *)visited);
+}
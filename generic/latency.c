@@ -0,0 +1,167 @@
+/*
+ * latency.c - Histogramas de latencia por etapa (estilo HDR)
+ * - Un shard por hilo y handle: cada hilo solo escribe en el suyo, sin locks
+ * - Buckets log-lineales: 32 sub-buckets por potencia de 2 (~3% de error)
+ * - La lectura suma todos los shards y calcula percentiles
+ */
+
+#include "tclembeddingInt.h"
+#include <string.h>
+#include <time.h>
+
+#define SUB_BITS     5
+#define SUB_COUNT    (1 << SUB_BITS)
+#define MAX_SHIFT    36                         // hasta ~2^41 ns (~36 min)
+#define BUCKET_COUNT ((MAX_SHIFT + 1) * SUB_COUNT)
+
+struct LatencyShard {
+    Tcl_ThreadId owner;
+    LatencyShard* next;
+    uint64_t counts[STAGE_COUNT][BUCKET_COUNT];
+};
+
+static const char *const stage_names[] = {
+    "tokenize", "tensor", "run", "pool", "marshal", "total", NULL
+};
+
+// Caché por hilo handle -> shard, para no tomar el mutex en cada muestra
+#define SHARD_CACHE_SIZE 8
+typedef struct {
+    uint64_t ids[SHARD_CACHE_SIZE];
+    LatencyShard* shards[SHARD_CACHE_SIZE];
+    int next_slot;
+} ShardCache;
+
+static Tcl_ThreadDataKey shard_cache_key;
+
+uint64_t Latency_Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline int BucketIndex(uint64_t ns) {
+    if (ns < 2 * SUB_COUNT) return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+    if (shift > MAX_SHIFT - 1) return BUCKET_COUNT - 1;
+    return (shift + 1) * SUB_COUNT + (int)(ns >> shift) - SUB_COUNT;
+}
+
+// Punto medio del bucket, en ns
+static double BucketValue(int idx) {
+    if (idx < 2 * SUB_COUNT) return (double)idx;
+    int shift = idx / SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + idx % SUB_COUNT) << shift;
+    return (double)low + (double)((uint64_t)1 << shift) / 2.0;
+}
+
+LatencyShard* Latency_ShardFor(EmbeddingState *state) {
+    ShardCache *cache = (ShardCache *) Tcl_GetThreadData(&shard_cache_key, sizeof(ShardCache));
+    for (int i = 0; i < SHARD_CACHE_SIZE; i++) {
+        if (cache->ids[i] == state->id && cache->shards[i]) return cache->shards[i];
+    }
+
+    Tcl_ThreadId self = Tcl_GetCurrentThread();
+    Tcl_MutexLock(&state->latency_mutex);
+    LatencyShard *shard = state->latency_shards;
+    while (shard && shard->owner != self) shard = shard->next;
+    if (shard == NULL) {
+        shard = (LatencyShard *) ckalloc(sizeof(LatencyShard));
+        memset(shard, 0, sizeof(LatencyShard));
+        shard->owner = self;
+        shard->next = state->latency_shards;
+        state->latency_shards = shard;
+    }
+    Tcl_MutexUnlock(&state->latency_mutex);
+
+    cache->ids[cache->next_slot] = state->id;
+    cache->shards[cache->next_slot] = shard;
+    cache->next_slot = (cache->next_slot + 1) % SHARD_CACHE_SIZE;
+    return shard;
+}
+
+void Latency_Record(LatencyShard *shard, EmbeddingStage stage, uint64_t ns) {
+    // Solo el hilo dueño escribe: load+store relajados bastan (sin lock prefix)
+    uint64_t *slot = &shard->counts[stage][BucketIndex(ns)];
+    __atomic_store_n(slot, __atomic_load_n(slot, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+void Latency_Free(EmbeddingState *state) {
+    LatencyShard *shard = state->latency_shards;
+    while (shard) {
+        LatencyShard *next = shard->next;
+        ckfree((char *)shard);
+        shard = next;
+    }
+    state->latency_shards = NULL;
+    Tcl_MutexFinalize(&state->latency_mutex);
+}
+
+// Suma los shards de una etapa y arma {count p50 p90 p99 p999 max} en µs
+static Tcl_Obj* StageSummary(EmbeddingState *state, int stage) {
+    static const double quantiles[] = {0.50, 0.90, 0.99, 0.999};
+    static const char *const quantile_names[] = {"p50", "p90", "p99", "p999"};
+    uint64_t *merged = (uint64_t *) ckalloc(sizeof(uint64_t) * BUCKET_COUNT);
+    memset(merged, 0, sizeof(uint64_t) * BUCKET_COUNT);
+
+    Tcl_MutexLock(&state->latency_mutex);
+    for (LatencyShard *shard = state->latency_shards; shard; shard = shard->next) {
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            merged[i] += __atomic_load_n(&shard->counts[stage][i], __ATOMIC_RELAXED);
+        }
+    }
+    Tcl_MutexUnlock(&state->latency_mutex);
+
+    uint64_t total = 0;
+    int max_idx = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        total += merged[i];
+        if (merged[i]) max_idx = i;
+    }
+
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("count", -1), Tcl_NewWideIntObj((Tcl_WideInt)total));
+    uint64_t seen = 0;
+    int bucket = 0;
+    for (int q = 0; q < 4; q++) {
+        double value = 0.0;
+        if (total > 0) {
+            uint64_t rank = (uint64_t)(quantiles[q] * (double)total + 0.5);
+            if (rank < 1) rank = 1;
+            while (bucket < BUCKET_COUNT && seen + merged[bucket] < rank) seen += merged[bucket++];
+            value = BucketValue(bucket) / 1000.0;
+        }
+        Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj(quantile_names[q], -1), Tcl_NewDoubleObj(value));
+    }
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("max", -1),
+                   Tcl_NewDoubleObj(total ? BucketValue(max_idx) / 1000.0 : 0.0));
+
+    ckfree((char *)merged);
+    return dict;
+}
+
+// --- LATENCY ---
+// embedding::latency handle ?stage?
+int TclEmbedding_Latency_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    if (objc != 2 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "handle ?stage?");
+        return TCL_ERROR;
+    }
+
+    EmbeddingState *state;
+    if (GetEmbeddingState(interp, objv[1], &state) != TCL_OK) return TCL_ERROR;
+
+    if (objc == 3) {
+        int stage;
+        if (Tcl_GetIndexFromObj(interp, objv[2], stage_names, "stage", 0, &stage) != TCL_OK) return TCL_ERROR;
+        Tcl_SetObjResult(interp, StageSummary(state, stage));
+        return TCL_OK;
+    }
+
+    Tcl_Obj *result = Tcl_NewDictObj();
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        Tcl_DictObjPut(NULL, result, Tcl_NewStringObj(stage_names[stage], -1), StageSummary(state, stage));
+    }
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
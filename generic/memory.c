@@ -0,0 +1,248 @@
+/*
+ * memory.c - Contabilidad de memoria y presupuesto global del proceso
+ * - Una cuenta por consumidor: modelo, vocabulario, caché o índice
+ * - Presupuesto opcional: al pasarse se desalojan cachés (LRU primero) y,
+ *   si no alcanza, se rechaza el crecimiento (Memory_Reserve falla)
+ */
+
+#include "tclembeddingInt.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+static const char *const kind_names[] = {"model", "vocab", "cache", "index", NULL};
+
+TCL_DECLARE_MUTEX(g_memory_mutex)
+static MemAccount* g_accounts = NULL;   // Lista doble, ordenada por uso (más reciente primero)
+static size_t g_used = 0;
+static size_t g_budget = 0;             // 0 = sin límite
+static uint64_t g_clock = 0;
+
+static void Unlink(MemAccount *acct) {
+    if (acct->prev) acct->prev->next = acct->next;
+    else g_accounts = acct->next;
+    if (acct->next) acct->next->prev = acct->prev;
+    acct->prev = acct->next = NULL;
+}
+
+static void PushFront(MemAccount *acct) {
+    acct->prev = NULL;
+    acct->next = g_accounts;
+    if (g_accounts) g_accounts->prev = acct;
+    g_accounts = acct;
+}
+
+void Memory_Register(MemAccount *acct, MemKind kind, const char *name, MemEvictProc *evict, void *owner) {
+    acct->kind = kind;
+    snprintf(acct->name, sizeof(acct->name), "%s", name);
+    acct->bytes = 0;
+    acct->evict = evict;
+    acct->owner = owner;
+    Tcl_MutexLock(&g_memory_mutex);
+    acct->last_used = ++g_clock;
+    PushFront(acct);
+    Tcl_MutexUnlock(&g_memory_mutex);
+}
+
+void Memory_Unregister(MemAccount *acct) {
+    Tcl_MutexLock(&g_memory_mutex);
+    g_used -= acct->bytes;
+    acct->bytes = 0;
+    Unlink(acct);
+    Tcl_MutexUnlock(&g_memory_mutex);
+}
+
+void Memory_Touch(MemAccount *acct) {
+    Tcl_MutexLock(&g_memory_mutex);
+    acct->last_used = ++g_clock;
+    if (g_accounts != acct) {
+        Unlink(acct);
+        PushFront(acct);
+    }
+    Tcl_MutexUnlock(&g_memory_mutex);
+}
+
+// Desaloja cachés desde la menos usada hasta liberar `want` bytes.
+// Se llama con el mutex tomado; el callback no debe volver a tomarlo.
+static size_t EvictCaches(size_t want, MemAccount *except) {
+    size_t freed = 0;
+    MemAccount *tail = g_accounts;
+    while (tail && tail->next) tail = tail->next;
+
+    for (MemAccount *acct = tail; acct && freed < want; acct = acct->prev) {
+        if (acct->kind != MEM_CACHE || acct == except || acct->evict == NULL || acct->bytes == 0) continue;
+        size_t got = acct->evict(acct, want - freed);
+        if (got > acct->bytes) got = acct->bytes;
+        acct->bytes -= got;
+        g_used -= got;
+        freed += got;
+    }
+    return freed;
+}
+
+int Memory_Reserve(MemAccount *acct, size_t bytes) {
+    int ok = 1;
+    Tcl_MutexLock(&g_memory_mutex);
+    if (g_budget && g_used + bytes > g_budget) {
+        EvictCaches(g_used + bytes - g_budget, acct);
+        ok = (g_used + bytes <= g_budget);
+    }
+    if (ok) {
+        acct->bytes += bytes;
+        g_used += bytes;
+    }
+    Tcl_MutexUnlock(&g_memory_mutex);
+    return ok;
+}
+
+void Memory_Charge(MemAccount *acct, size_t bytes) {
+    Tcl_MutexLock(&g_memory_mutex);
+    acct->bytes += bytes;
+    g_used += bytes;
+    if (g_budget && g_used > g_budget) EvictCaches(g_used - g_budget, acct);
+    Tcl_MutexUnlock(&g_memory_mutex);
+}
+
+void Memory_Release(MemAccount *acct, size_t bytes) {
+    Tcl_MutexLock(&g_memory_mutex);
+    if (bytes > acct->bytes) bytes = acct->bytes;
+    acct->bytes -= bytes;
+    g_used -= bytes;
+    Tcl_MutexUnlock(&g_memory_mutex);
+}
+
+int Memory_ReserveOrError(Tcl_Interp *interp, MemAccount *acct, size_t bytes) {
+    if (Memory_Reserve(acct, bytes)) return TCL_OK;
+
+    char msg[256];
+    Tcl_MutexLock(&g_memory_mutex);
+    snprintf(msg, sizeof(msg), "memory budget exceeded: %s \"%s\" needs %" PRIu64 " bytes, %" PRIu64 " of %" PRIu64 " in use",
+             kind_names[acct->kind], acct->name, (uint64_t)bytes, (uint64_t)g_used, (uint64_t)g_budget);
+    Tcl_MutexUnlock(&g_memory_mutex);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(msg, -1));
+    Tcl_SetErrorCode(interp, "EMBEDDING", "MEMORY", "BUDGET", NULL);
+    return TCL_ERROR;
+}
+
+// --- Cuentas creadas desde Tcl (p. ej. el vocabulario de tokenizer.tcl) ---
+
+static MemAccount* FindTracked(MemKind kind, const char *name) {
+    for (MemAccount *acct = g_accounts; acct; acct = acct->next) {
+        if (acct->owner == NULL && acct->kind == kind && strcmp(acct->name, name) == 0) return acct;
+    }
+    return NULL;
+}
+
+static int MemoryTrack(Tcl_Interp *interp, Tcl_Obj *kindObj, Tcl_Obj *nameObj, Tcl_Obj *bytesObj) {
+    int kind;
+    Tcl_WideInt bytes;
+    if (Tcl_GetIndexFromObj(interp, kindObj, kind_names, "kind", 0, &kind) != TCL_OK) return TCL_ERROR;
+    if (Tcl_GetWideIntFromObj(interp, bytesObj, &bytes) != TCL_OK) return TCL_ERROR;
+    if (bytes < 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("bytes must be >= 0", -1));
+        return TCL_ERROR;
+    }
+
+    const char *name = Tcl_GetString(nameObj);
+    Tcl_MutexLock(&g_memory_mutex);
+    MemAccount *acct = FindTracked((MemKind)kind, name);
+    Tcl_MutexUnlock(&g_memory_mutex);
+
+    if (acct == NULL) {
+        if (bytes == 0) return TCL_OK;
+        acct = (MemAccount *) ckalloc(sizeof(MemAccount));
+        Memory_Register(acct, (MemKind)kind, name, NULL, NULL);
+    }
+    // Solo se reserva la diferencia: si no entra, el cargo anterior queda
+    // intacto (lo que ya estaba residente sigue contado)
+    int result = TCL_OK;
+    if ((size_t)bytes > acct->bytes) {
+        result = Memory_ReserveOrError(interp, acct, (size_t)bytes - acct->bytes);
+    } else {
+        Memory_Release(acct, acct->bytes - (size_t)bytes);
+    }
+    if (acct->bytes == 0) {
+        Memory_Unregister(acct);
+        ckfree((char *)acct);
+    }
+    return result;
+}
+
+static Tcl_Obj* MemoryReport(void) {
+    Tcl_WideInt by_kind[MEM_KIND_COUNT] = {0};
+    Tcl_Obj *accounts = Tcl_NewListObj(0, NULL);
+
+    Tcl_MutexLock(&g_memory_mutex);
+    for (MemAccount *acct = g_accounts; acct; acct = acct->next) {
+        Tcl_Obj *entry = Tcl_NewDictObj();
+        Tcl_DictObjPut(NULL, entry, Tcl_NewStringObj("kind", -1), Tcl_NewStringObj(kind_names[acct->kind], -1));
+        Tcl_DictObjPut(NULL, entry, Tcl_NewStringObj("name", -1), Tcl_NewStringObj(acct->name, -1));
+        Tcl_DictObjPut(NULL, entry, Tcl_NewStringObj("bytes", -1), Tcl_NewWideIntObj((Tcl_WideInt)acct->bytes));
+        Tcl_ListObjAppendElement(NULL, accounts, entry);
+        by_kind[acct->kind] += (Tcl_WideInt)acct->bytes;
+    }
+    Tcl_WideInt used = (Tcl_WideInt)g_used, budget = (Tcl_WideInt)g_budget;
+    Tcl_MutexUnlock(&g_memory_mutex);
+
+    Tcl_Obj *kinds = Tcl_NewDictObj();
+    for (int k = 0; k < MEM_KIND_COUNT; k++) {
+        Tcl_DictObjPut(NULL, kinds, Tcl_NewStringObj(kind_names[k], -1), Tcl_NewWideIntObj(by_kind[k]));
+    }
+
+    Tcl_Obj *report = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, report, Tcl_NewStringObj("budget", -1), Tcl_NewWideIntObj(budget));
+    Tcl_DictObjPut(NULL, report, Tcl_NewStringObj("used", -1), Tcl_NewWideIntObj(used));
+    Tcl_DictObjPut(NULL, report, Tcl_NewStringObj("by_kind", -1), kinds);
+    Tcl_DictObjPut(NULL, report, Tcl_NewStringObj("accounts", -1), accounts);
+    return report;
+}
+
+// --- MEMORY ---
+// embedding::memory
+// embedding::memory budget ?bytes?
+// embedding::memory track kind name bytes
+int TclEmbedding_Memory_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const subcommands[] = {"budget", "track", NULL};
+    enum { SUB_BUDGET, SUB_TRACK };
+
+    if (objc == 1) {
+        Tcl_SetObjResult(interp, MemoryReport());
+        return TCL_OK;
+    }
+
+    int sub;
+    if (Tcl_GetIndexFromObj(interp, objv[1], subcommands, "subcommand", 0, &sub) != TCL_OK) return TCL_ERROR;
+
+    switch (sub) {
+    case SUB_BUDGET: {
+        if (objc > 3) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?bytes?");
+            return TCL_ERROR;
+        }
+        if (objc == 3) {
+            Tcl_WideInt bytes;
+            if (Tcl_GetWideIntFromObj(interp, objv[2], &bytes) != TCL_OK) return TCL_ERROR;
+            if (bytes < 0) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("budget must be >= 0", -1));
+                return TCL_ERROR;
+            }
+            // Un presupuesto más chico desaloja cachés de inmediato
+            Tcl_MutexLock(&g_memory_mutex);
+            g_budget = (size_t)bytes;
+            if (g_budget && g_used > g_budget) EvictCaches(g_used - g_budget, NULL);
+            Tcl_MutexUnlock(&g_memory_mutex);
+        }
+        Tcl_MutexLock(&g_memory_mutex);
+        Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)g_budget));
+        Tcl_MutexUnlock(&g_memory_mutex);
+        return TCL_OK;
+    }
+    case SUB_TRACK:
+        if (objc != 5) {
+            Tcl_WrongNumArgs(interp, 2, objv, "kind name bytes");
+            return TCL_ERROR;
+        }
+        return MemoryTrack(interp, objv[2], objv[3], objv[4]);
+    }
+    return TCL_ERROR;
+}
@@ -0,0 +1,381 @@
+/*
+ * pca.c - Proyección lineal (PCA) de los embeddings a menos dimensiones
+ * - embedding::pca_fit entrena la proyección desde una muestra de vectores
+ * - init_raw -projection la aplica después del pooling y renormaliza
+ *
+ * Formato del archivo (enteros y floats nativos):
+ *   "TEPJ" | uint32 versión (1) | uint32 D | uint32 d'
+ *   float32 media[D] | float32 componentes[d'][D]
+ * Cada componente es una fila contigua: la proyección es d' productos
+ * punto SIMD (GEMV) sobre el vector centrado.
+ */
+
+#include "tclembeddingInt.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROJECTION_MAGIC   "TEPJ"
+#define PROJECTION_VERSION 1
+
+struct Projection {
+    int in_dim;
+    int out_dim;
+    float* mean;        // in_dim
+    float* components;  // out_dim x in_dim
+};
+
+// --- CARGA Y APLICACIÓN ---
+
+int Projection_Load(Tcl_Interp *interp, const char *path, Projection **projPtr) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot open projection \"%s\": %s", path, Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+
+    char magic[4];
+    uint32_t header[3];
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, PROJECTION_MAGIC, 4) != 0 ||
+        fread(header, sizeof(uint32_t), 3, f) != 3 || header[0] != PROJECTION_VERSION ||
+        header[1] == 0 || header[2] == 0 || header[2] > header[1] || header[1] > 65536) {
+        fclose(f);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is not a projection file written by embedding::pca_fit", path));
+        return TCL_ERROR;
+    }
+
+    Projection *proj = (Projection *) ckalloc(sizeof(Projection));
+    proj->in_dim = (int)header[1];
+    proj->out_dim = (int)header[2];
+    size_t mean_len = (size_t)proj->in_dim;
+    size_t comp_len = (size_t)proj->out_dim * proj->in_dim;
+    proj->mean = (float *) ckalloc(sizeof(float) * mean_len);
+    proj->components = (float *) ckalloc(sizeof(float) * comp_len);
+
+    int ok = fread(proj->mean, sizeof(float), mean_len, f) == mean_len &&
+             fread(proj->components, sizeof(float), comp_len, f) == comp_len;
+    fclose(f);
+    if (!ok) {
+        Projection_Free(proj);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("projection file \"%s\" is truncated", path));
+        return TCL_ERROR;
+    }
+    *projPtr = proj;
+    return TCL_OK;
+}
+
+void Projection_Free(Projection *proj) {
+    if (proj == NULL) return;
+    ckfree((char *)proj->mean);
+    ckfree((char *)proj->components);
+    ckfree((char *)proj);
+}
+
+int Projection_InDim(const Projection *proj) { return proj->in_dim; }
+int Projection_OutDim(const Projection *proj) { return proj->out_dim; }
+
+size_t Projection_Bytes(const Projection *proj) {
+    return sizeof(Projection) + sizeof(float) * (size_t)proj->in_dim * (proj->out_dim + 1);
+}
+
+// rows x in_dim -> rows x out_dim, cada fila renormalizada a norma 1
+void Projection_Apply(const Projection *proj, const double *in, double *out, Tcl_Size rows) {
+    int D = proj->in_dim, d = proj->out_dim;
+    float *centered = (float *) ckalloc(sizeof(float) * D);
+    for (Tcl_Size r = 0; r < rows; r++) {
+        const double *x = in + (size_t)r * D;
+        double *y = out + (size_t)r * d;
+        for (int i = 0; i < D; i++) centered[i] = (float)x[i] - proj->mean[i];
+
+        double norm = 0.0;
+        for (int j = 0; j < d; j++) {
+            y[j] = Vec_Dot(proj->components + (size_t)j * D, centered, D);
+            norm += y[j] * y[j];
+        }
+        norm = sqrt(norm);
+        if (norm < 1e-9) norm = 1e-9;
+        for (int j = 0; j < d; j++) y[j] /= norm;
+    }
+    ckfree((char *)centered);
+}
+
+// --- AJUSTE ---
+
+// Householder a forma tridiagonal (tred2 de EISPACK, vía JAMA).
+// V (n x n, por filas) entra con la matriz simétrica y sale con la
+// transformación; d y e quedan con la diagonal y la subdiagonal.
+static void Tridiagonalize(int n, double *V, double *d, double *e) {
+#define A(i, j) V[(size_t)(i) * n + (j)]
+    for (int j = 0; j < n; j++) d[j] = A(n - 1, j);
+
+    for (int i = n - 1; i > 0; i--) {
+        double scale = 0.0, h = 0.0;
+        for (int k = 0; k < i; k++) scale += fabs(d[k]);
+        if (scale == 0.0) {
+            e[i] = d[i - 1];
+            for (int j = 0; j < i; j++) {
+                d[j] = A(i - 1, j);
+                A(i, j) = 0.0;
+                A(j, i) = 0.0;
+            }
+        } else {
+            for (int k = 0; k < i; k++) {
+                d[k] /= scale;
+                h += d[k] * d[k];
+            }
+            double f = d[i - 1];
+            double g = sqrt(h);
+            if (f > 0) g = -g;
+            e[i] = scale * g;
+            h -= f * g;
+            d[i - 1] = f - g;
+            for (int j = 0; j < i; j++) e[j] = 0.0;
+
+            for (int j = 0; j < i; j++) {
+                f = d[j];
+                A(j, i) = f;
+                g = e[j] + A(j, j) * f;
+                for (int k = j + 1; k <= i - 1; k++) {
+                    g += A(k, j) * d[k];
+                    e[k] += A(k, j) * f;
+                }
+                e[j] = g;
+            }
+            f = 0.0;
+            for (int j = 0; j < i; j++) {
+                e[j] /= h;
+                f += e[j] * d[j];
+            }
+            double hh = f / (h + h);
+            for (int j = 0; j < i; j++) e[j] -= hh * d[j];
+            for (int j = 0; j < i; j++) {
+                f = d[j];
+                g = e[j];
+                for (int k = j; k <= i - 1; k++) A(k, j) -= (f * e[k] + g * d[k]);
+                d[j] = A(i - 1, j);
+                A(i, j) = 0.0;
+            }
+        }
+        d[i] = h;
+    }
+
+    // Acumular las transformaciones
+    for (int i = 0; i < n - 1; i++) {
+        A(n - 1, i) = A(i, i);
+        A(i, i) = 1.0;
+        double h = d[i + 1];
+        if (h != 0.0) {
+            for (int k = 0; k <= i; k++) d[k] = A(k, i + 1) / h;
+            for (int j = 0; j <= i; j++) {
+                double g = 0.0;
+                for (int k = 0; k <= i; k++) g += A(k, i + 1) * A(k, j);
+                for (int k = 0; k <= i; k++) A(k, j) -= g * d[k];
+            }
+        }
+        for (int k = 0; k <= i; k++) A(k, i + 1) = 0.0;
+    }
+    for (int j = 0; j < n; j++) {
+        d[j] = A(n - 1, j);
+        A(n - 1, j) = 0.0;
+    }
+    A(n - 1, n - 1) = 1.0;
+    e[0] = 0.0;
+#undef A
+}
+
+// QL implícito sobre la tridiagonal (tql2). Z es la transpuesta de la V de
+// Tridiagonalize: así cada rotación toca dos filas contiguas. Al terminar,
+// d tiene los autovalores y la fila j de Z el autovector j.
+static int TridiagonalQL(int n, double *Z, double *d, double *e) {
+    for (int i = 1; i < n; i++) e[i - 1] = e[i];
+    e[n - 1] = 0.0;
+
+    double f = 0.0, tst1 = 0.0;
+    const double eps = ldexp(1.0, -52);
+    for (int l = 0; l < n; l++) {
+        tst1 = fmax(tst1, fabs(d[l]) + fabs(e[l]));
+        int m = l;
+        while (m < n && fabs(e[m]) > eps * tst1) m++;
+
+        if (m > l) {
+            int iter = 0;
+            do {
+                if (++iter > 64) return 0;
+                double g = d[l];
+                double p = (d[l + 1] - g) / (2.0 * e[l]);
+                double r = hypot(p, 1.0);
+                if (p < 0) r = -r;
+                d[l] = e[l] / (p + r);
+                d[l + 1] = e[l] * (p + r);
+                double dl1 = d[l + 1];
+                double h = g - d[l];
+                for (int i = l + 2; i < n; i++) d[i] -= h;
+                f += h;
+
+                p = d[m];
+                double c = 1.0, c2 = 1.0, c3 = 1.0, el1 = e[l + 1];
+                double s = 0.0, s2 = 0.0;
+                for (int i = m - 1; i >= l; i--) {
+                    c3 = c2;
+                    c2 = c;
+                    s2 = s;
+                    g = c * e[i];
+                    h = c * p;
+                    r = hypot(p, e[i]);
+                    e[i + 1] = s * r;
+                    s = e[i] / r;
+                    c = p / r;
+                    p = c * d[i] - s * g;
+                    d[i + 1] = h + s * (c * g + s * d[i]);
+
+                    double *zi = Z + (size_t)i * n, *zi1 = zi + n;
+                    for (int k = 0; k < n; k++) {
+                        h = zi1[k];
+                        zi1[k] = s * zi[k] + c * h;
+                        zi[k] = c * zi[k] - s * h;
+                    }
+                }
+                p = -s * s2 * c3 * el1 * e[l] / dl1;
+                e[l] = s * p;
+                d[l] = c * p;
+            } while (fabs(e[l]) > eps * tst1);
+        }
+        d[l] += f;
+        e[l] = 0.0;
+    }
+    return 1;
+}
+
+static int WriteProjection(Tcl_Interp *interp, const char *path, int D, int k, const float *mean, const float *components) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot write projection \"%s\": %s", path, Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+    uint32_t header[3] = {PROJECTION_VERSION, (uint32_t)D, (uint32_t)k};
+    int ok = fwrite(PROJECTION_MAGIC, 1, 4, f) == 4 &&
+             fwrite(header, sizeof(uint32_t), 3, f) == 3 &&
+             fwrite(mean, sizeof(float), D, f) == (size_t)D &&
+             fwrite(components, sizeof(float), (size_t)k * D, f) == (size_t)k * D;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("error writing projection \"%s\": %s", path, Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+// --- PCA_FIT ---
+// embedding::pca_fit samples dim k file
+// `samples` es un bytearray de N x dim float32 (compute_batch -format binary).
+// Devuelve {in_dim out_dim samples explained}; explained es la fracción de
+// la varianza que conservan las k componentes.
+int TclEmbedding_PcaFit_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    if (objc != 5) {
+        Tcl_WrongNumArgs(interp, 1, objv, "samples dim k file");
+        return TCL_ERROR;
+    }
+
+    int D, k;
+    if (Tcl_GetIntFromObj(interp, objv[2], &D) != TCL_OK) return TCL_ERROR;
+    if (Tcl_GetIntFromObj(interp, objv[3], &k) != TCL_OK) return TCL_ERROR;
+    if (D <= 0 || D > 65536 || k <= 0 || k > D) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("need 0 < k <= dim <= 65536", -1));
+        return TCL_ERROR;
+    }
+
+    Tcl_Size bytes = 0;
+    const float *samples = (const float *) Tcl_GetByteArrayFromObj(objv[1], &bytes);
+    if (samples == NULL || bytes == 0 || (size_t)bytes % ((size_t)D * sizeof(float)) != 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("samples must be a bytearray of N x %d float32", D));
+        return TCL_ERROR;
+    }
+    size_t N = (size_t)bytes / ((size_t)D * sizeof(float));
+    if (N < 2) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("need at least 2 samples", -1));
+        return TCL_ERROR;
+    }
+    for (size_t i = 0; i < N * D; i++) {
+        if (!isfinite(samples[i])) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("samples contain NaN or Inf", -1));
+            return TCL_ERROR;
+        }
+    }
+
+    // Media y muestra centrada, transpuesta (D x N) para que cada
+    // covarianza sea un producto punto contiguo
+    double *mean_acc = (double *) ckalloc(sizeof(double) * D);
+    memset(mean_acc, 0, sizeof(double) * D);
+    for (size_t n = 0; n < N; n++) {
+        for (int i = 0; i < D; i++) mean_acc[i] += samples[n * D + i];
+    }
+    float *mean = (float *) ckalloc(sizeof(float) * D);
+    for (int i = 0; i < D; i++) mean[i] = (float)(mean_acc[i] / (double)N);
+    ckfree((char *)mean_acc);
+
+    float *cols = (float *) ckalloc(sizeof(float) * N * D);
+    for (size_t n = 0; n < N; n++) {
+        for (int i = 0; i < D; i++) cols[(size_t)i * N + n] = samples[n * D + i] - mean[i];
+    }
+
+    double *V = (double *) ckalloc(sizeof(double) * D * D);
+    for (int i = 0; i < D; i++) {
+        for (int j = 0; j <= i; j++) {
+            double c = Vec_Dot(cols + (size_t)i * N, cols + (size_t)j * N, (int)N) / (double)(N - 1);
+            V[(size_t)i * D + j] = V[(size_t)j * D + i] = c;
+        }
+    }
+    ckfree((char *)cols);
+
+    double *d = (double *) ckalloc(sizeof(double) * D);
+    double *e = (double *) ckalloc(sizeof(double) * D);
+    Tridiagonalize(D, V, d, e);
+
+    // Transponer en el lugar: a partir de aquí la fila j es el autovector j
+    for (int i = 0; i < D; i++) {
+        for (int j = i + 1; j < D; j++) {
+            double t = V[(size_t)i * D + j];
+            V[(size_t)i * D + j] = V[(size_t)j * D + i];
+            V[(size_t)j * D + i] = t;
+        }
+    }
+    int converged = TridiagonalQL(D, V, d, e);
+    ckfree((char *)e);
+    if (!converged) {
+        ckfree((char *)V);
+        ckfree((char *)d);
+        ckfree((char *)mean);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("PCA eigensolver did not converge", -1));
+        return TCL_ERROR;
+    }
+
+    // Las k componentes de mayor varianza, en orden descendente
+    double total = 0.0, kept = 0.0;
+    for (int i = 0; i < D; i++) total += fmax(d[i], 0.0);
+    float *components = (float *) ckalloc(sizeof(float) * (size_t)k * D);
+    for (int c = 0; c < k; c++) {
+        int best = -1;
+        for (int i = 0; i < D; i++) {
+            if (!isnan(d[i]) && (best < 0 || d[i] > d[best])) best = i;
+        }
+        kept += fmax(d[best], 0.0);
+        d[best] = NAN;
+        for (int i = 0; i < D; i++) components[(size_t)c * D + i] = (float)V[(size_t)best * D + i];
+    }
+    ckfree((char *)V);
+    ckfree((char *)d);
+
+    int result = WriteProjection(interp, Tcl_GetString(objv[4]), D, k, mean, components);
+    ckfree((char *)mean);
+    ckfree((char *)components);
+    if (result != TCL_OK) return result;
+
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("in_dim", -1), Tcl_NewIntObj(D));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("out_dim", -1), Tcl_NewIntObj(k));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("samples", -1), Tcl_NewWideIntObj((Tcl_WideInt)N));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("explained", -1), Tcl_NewDoubleObj(total > 0.0 ? kept / total : 0.0));
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
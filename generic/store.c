@@ -0,0 +1,1325 @@
+/*
+ * store.c - Almacén de vectores en proceso (búsqueda exacta)
+ * - Las filas se normalizan al insertar: la similitud coseno es un producto punto
+ * - Cada fila lleva un atributo float (p. ej. edad en días) y una categoría
+ * - El puntaje sim * exp(-decay * attr) + peso[categoría] se calcula en el
+ *   mismo barrido que el producto punto, antes del top-k: no hace falta
+ *   pedir de más y reordenar en Tcl
+ * - Filtro por categoría con planificador de costos: barrido completo,
+ *   solo las filas del filtro o sondeo IVF, según la selectividad estimada
+ *   con los conteos por categoría
+ * - -target_latency_ms: el sondeo IVF más amplio que entra en el presupuesto,
+ *   según un modelo de latencia recalibrado con cada búsqueda
+ * - Realimentación Rocchio (embedding::refine) y búsqueda en dos rondas que
+ *   reordena los candidatos de la primera sin volver a barrer el almacén
+ * - -layout blocked intercala las filas de a STORE_BLOCK, dimensión por
+ *   dimensión: el barrido completo saca STORE_BLOCK puntajes por pasada sin
+ *   sumas horizontales y lee la memoria en orden
+ * - reorder renumera las filas para que cada lista IVF quede contigua en
+ *   memoria y las listas vecinas juntas (ids, atributos y listas se mueven
+ *   con ellas)
+ * - La memoria se contabiliza como "index" y respeta el presupuesto global
+ */
+
+#include "tclembeddingInt.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STORE_MIN_CAPACITY 1024
+
+static size_t RowBytes(const VectorStore *store) {
+    // Vector, id, atributo, categoría y una entrada en la lista de su
+    // categoría y en la de su lista IVF
+    return (size_t)store->dim * sizeof(float) + sizeof(Tcl_WideInt) + sizeof(float) + sizeof(int) + 2 * sizeof(Tcl_Size);
+}
+
+void RowList_Push(RowList *list, Tcl_Size row) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->rows = (Tcl_Size *) ckrealloc((char *)list->rows, sizeof(Tcl_Size) * list->capacity);
+    }
+    list->rows[list->count++] = row;
+}
+
+static void VectorStore_Delete(ClientData cd) {
+    VectorStore *store = (VectorStore *) cd;
+    ckfree((char *)store->vectors);
+    ckfree((char *)store->ids);
+    ckfree((char *)store->attrs);
+    ckfree((char *)store->categories);
+    for (int c = 0; c < store->category_capacity; c++) ckfree((char *)store->category_rows[c].rows);
+    ckfree((char *)store->category_rows);
+    Ivf_Free(store);
+    Tcl_DeleteHashTable(&store->category_index);
+    Tcl_DecrRefCount(store->category_names);
+    Memory_Unregister(&store->mem);
+    ckfree((char *)store);
+}
+
+static int VectorStoreHandle_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is a vector store handle; use embedding::store", Tcl_GetString(objv[0])));
+    return TCL_ERROR;
+}
+
+int GetVectorStore(Tcl_Interp *interp, Tcl_Obj *handle, VectorStore **storePtr) {
+    Tcl_CmdInfo info;
+    if (!Tcl_GetCommandInfo(interp, Tcl_GetString(handle), &info) || info.deleteProc != VectorStore_Delete) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid vector store handle \"%s\"", Tcl_GetString(handle)));
+        return TCL_ERROR;
+    }
+    *storePtr = (VectorStore *) info.objClientData;
+    return TCL_OK;
+}
+
+// Asegura espacio para `extra` filas más; el crecimiento pasa por el presupuesto
+static int StoreGrow(Tcl_Interp *interp, VectorStore *store, Tcl_Size extra) {
+    if (store->count + extra <= store->capacity) return TCL_OK;
+
+    Tcl_Size capacity = store->capacity ? store->capacity : STORE_MIN_CAPACITY;
+    while (capacity < store->count + extra) capacity *= 2;
+    if (Memory_ReserveOrError(interp, &store->mem, (size_t)(capacity - store->capacity) * RowBytes(store)) != TCL_OK) {
+        return TCL_ERROR;
+    }
+
+    store->vectors = (float *) ckrealloc((char *)store->vectors, (size_t)capacity * store->dim * sizeof(float));
+    if (store->blocked) {
+        // Los carriles sin fila del último bloque se puntúan igual: en cero
+        memset(store->vectors + (size_t)store->capacity * store->dim, 0,
+               (size_t)(capacity - store->capacity) * store->dim * sizeof(float));
+    }
+    store->ids = (Tcl_WideInt *) ckrealloc((char *)store->ids, (size_t)capacity * sizeof(Tcl_WideInt));
+    store->attrs = (float *) ckrealloc((char *)store->attrs, (size_t)capacity * sizeof(float));
+    store->categories = (int *) ckrealloc((char *)store->categories, (size_t)capacity * sizeof(int));
+    store->capacity = capacity;
+    return TCL_OK;
+}
+
+static int CategoryIndex(VectorStore *store, Tcl_Obj *nameObj) {
+    int isNew;
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&store->category_index, Tcl_GetString(nameObj), &isNew);
+    if (isNew) {
+        Tcl_Size n;
+        Tcl_ListObjLength(NULL, store->category_names, &n);
+        Tcl_SetHashValue(entry, (ClientData)(intptr_t)n);
+        Tcl_ListObjAppendElement(NULL, store->category_names, nameObj);
+        if (n == store->category_capacity) {
+            int capacity = store->category_capacity ? store->category_capacity * 2 : 8;
+            store->category_rows = (RowList *) ckrealloc((char *)store->category_rows, sizeof(RowList) * capacity);
+            memset(store->category_rows + n, 0, sizeof(RowList) * (capacity - n));
+            store->category_capacity = capacity;
+        }
+    }
+    return (int)(intptr_t)Tcl_GetHashValue(entry);
+}
+
+// --- KERNELS ---
+// Casi todos los embeddings tienen 384, 768 o 1024 dimensiones. Con la
+// longitud constante (múltiplo de 32) el bucle no tiene cola y reparte el
+// trabajo en cuatro acumuladores independientes: el único acumulador de
+// Vec_Dot queda limitado por la latencia de la FMA. Desenrollar x4 rinde
+// lo mismo que desenrollar del todo, con la cuarta parte del código.
+#if defined(__AVX2__) && defined(__FMA__)
+#define VEC_DOT_STEP(acc, off) \
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + (off)), _mm256_loadu_ps(b + i + (off)), acc)
+
+#define VEC_DOT_FIXED(D)                                                            \
+static float Vec_Dot##D(const float *a, const float *b, int n) {                    \
+    (void)n;                                                                        \
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();                      \
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();                      \
+    _Pragma("GCC unroll 4")                                                         \
+    for (int i = 0; i < (D); i += 32) {                                             \
+        VEC_DOT_STEP(s0, 0);                                                        \
+        VEC_DOT_STEP(s1, 8);                                                        \
+        VEC_DOT_STEP(s2, 16);                                                       \
+        VEC_DOT_STEP(s3, 24);                                                       \
+    }                                                                               \
+    __m256 sum = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));       \
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1)); \
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));                                         \
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));                                          \
+    return _mm_cvtss_f32(s);                                                        \
+}
+
+VEC_DOT_FIXED(384)
+VEC_DOT_FIXED(768)
+VEC_DOT_FIXED(1024)
+#endif
+
+// Productos punto de la consulta con las STORE_BLOCK filas de un bloque
+// (dim x STORE_BLOCK): cada dimensión es una FMA por registro con la
+// consulta difundida, y los puntajes salen ya separados por fila
+static void Vec_DotBlock(const float *query, const float *block, int dim, float *scores) {
+#if defined(__AVX2__) && defined(__FMA__)
+    // Cuatro dimensiones por vuelta: ocho acumuladores independientes
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+    __m256 b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+    __m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps();
+    __m256 d0 = _mm256_setzero_ps(), d1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        const float *p = block + (size_t)i * STORE_BLOCK;
+        __m256 q0 = _mm256_broadcast_ss(query + i), q1 = _mm256_broadcast_ss(query + i + 1);
+        __m256 q2 = _mm256_broadcast_ss(query + i + 2), q3 = _mm256_broadcast_ss(query + i + 3);
+        a0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(p), a0);
+        a1 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(p + 8), a1);
+        b0 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(p + 16), b0);
+        b1 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(p + 24), b1);
+        c0 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(p + 32), c0);
+        c1 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(p + 40), c1);
+        d0 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(p + 48), d0);
+        d1 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(p + 56), d1);
+    }
+    for (; i < dim; i++) {
+        const float *p = block + (size_t)i * STORE_BLOCK;
+        __m256 q0 = _mm256_broadcast_ss(query + i);
+        a0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(p), a0);
+        a1 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(p + 8), a1);
+    }
+    a0 = _mm256_add_ps(_mm256_add_ps(a0, b0), _mm256_add_ps(c0, d0));
+    a1 = _mm256_add_ps(_mm256_add_ps(a1, b1), _mm256_add_ps(c1, d1));
+    _mm256_storeu_ps(scores, a0);
+    _mm256_storeu_ps(scores + 8, a1);
+#else
+    for (int l = 0; l < STORE_BLOCK; l++) scores[l] = 0.0f;
+    for (int i = 0; i < dim; i++) {
+        const float *p = block + (size_t)i * STORE_BLOCK;
+        for (int l = 0; l < STORE_BLOCK; l++) scores[l] += query[i] * p[l];
+    }
+#endif
+}
+
+// Producto punto con una sola fila de un bloque (paso STORE_BLOCK): para
+// los planes que saltan de fila en fila (subset, IVF, refine)
+static float Vec_DotStrided(const float *query, const float *lane, int dim) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        s0 += query[i] * lane[(size_t)i * STORE_BLOCK];
+        s1 += query[i + 1] * lane[(size_t)(i + 1) * STORE_BLOCK];
+        s2 += query[i + 2] * lane[(size_t)(i + 2) * STORE_BLOCK];
+        s3 += query[i + 3] * lane[(size_t)(i + 3) * STORE_BLOCK];
+    }
+    for (; i < dim; i++) s0 += query[i] * lane[(size_t)i * STORE_BLOCK];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float Vec_DotAny(const float *a, const float *b, int n) {
+    return Vec_Dot(a, b, n);
+}
+
+VecDotProc *Vec_DotFor(int dim) {
+#if defined(__AVX2__) && defined(__FMA__)
+    switch (dim) {
+    case 384:  return Vec_Dot384;
+    case 768:  return Vec_Dot768;
+    case 1024: return Vec_Dot1024;
+    }
+#endif
+    (void)dim;
+    return Vec_DotAny;
+}
+
+// --- ROWS ---
+// Primer float de la fila en su bloque; las dimensiones siguen cada STORE_BLOCK
+static inline float *SlabLane(float *slab, int dim, Tcl_Size row) {
+    return slab + (size_t)(row / STORE_BLOCK) * STORE_BLOCK * dim + row % STORE_BLOCK;
+}
+
+static inline float *BlockLane(const VectorStore *store, Tcl_Size row) {
+    return SlabLane(store->vectors, store->dim, row);
+}
+
+// Escribe dim floats como la fila `row` de `slab` (el del almacén u otro
+// con su misma disposición)
+static void Store_PutRow(const VectorStore *store, float *slab, Tcl_Size row, const float *vec) {
+    if (!store->blocked) {
+        memcpy(slab + (size_t)row * store->dim, vec, sizeof(float) * store->dim);
+        return;
+    }
+    float *lane = SlabLane(slab, store->dim, row);
+    for (int i = 0; i < store->dim; i++) lane[(size_t)i * STORE_BLOCK] = vec[i];
+}
+
+// La fila como dim floats contiguos: un puntero al almacén, o copiada en
+// `scratch` (dim floats) si el almacén es -layout blocked
+const float *Store_Row(const VectorStore *store, Tcl_Size row, float *scratch) {
+    if (!store->blocked) return store->vectors + (size_t)row * store->dim;
+    const float *lane = BlockLane(store, row);
+    for (int i = 0; i < store->dim; i++) scratch[i] = lane[(size_t)i * STORE_BLOCK];
+    return scratch;
+}
+
+static inline float Store_Dot(const VectorStore *store, const float *query, Tcl_Size row) {
+    if (store->blocked) return Vec_DotStrided(query, BlockLane(store, row), store->dim);
+    return store->dot(query, store->vectors + (size_t)row * store->dim, store->dim);
+}
+
+// --- CREATE ---
+// embedding::store create dim ?-layout rows|blocked?
+static int StoreCreate(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-layout", NULL};
+    static const char *const layouts[] = {"rows", "blocked", NULL};
+
+    if (objc != 3 && objc != 5) {
+        Tcl_WrongNumArgs(interp, 2, objv, "dim ?-layout rows|blocked?");
+        return TCL_ERROR;
+    }
+    int dim, layout = 0;
+    if (Tcl_GetIntFromObj(interp, objv[2], &dim) != TCL_OK) return TCL_ERROR;
+    if (dim <= 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("dim must be > 0", -1));
+        return TCL_ERROR;
+    }
+    if (objc == 5) {
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[3], options, "option", 0, &opt) != TCL_OK) return TCL_ERROR;
+        if (Tcl_GetIndexFromObj(interp, objv[4], layouts, "layout", 0, &layout) != TCL_OK) return TCL_ERROR;
+    }
+
+    VectorStore *store = (VectorStore *) ckalloc(sizeof(VectorStore));
+    memset(store, 0, sizeof(VectorStore));
+    store->dim = dim;
+    store->dot = Vec_DotFor(dim);
+    store->blocked = layout;
+    Tcl_InitHashTable(&store->category_index, TCL_STRING_KEYS);
+    store->category_names = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(store->category_names);
+
+    char handle[64];
+    snprintf(handle, sizeof(handle), "vstore%p", (void *)store);
+    Memory_Register(&store->mem, MEM_INDEX, handle, NULL, store);
+
+    Tcl_CreateObjCommand(interp, handle, VectorStoreHandle_Cmd, store, VectorStore_Delete);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(handle, -1));
+    return TCL_OK;
+}
+
+// --- ADD ---
+// embedding::store add store ids vectors ?-attrs list? ?-categories list?
+// `vectors` es un bytearray de float32 nativos, fila tras fila (lo que
+// devuelve compute_batch -format binary)
+static int StoreAdd(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-attrs", "-categories", NULL};
+    enum { OPT_ATTRS, OPT_CATEGORIES };
+
+    if (objc < 5 || (objc % 2) == 0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "store ids vectors ?-attrs list? ?-categories list?");
+        return TCL_ERROR;
+    }
+
+    VectorStore *store;
+    if (GetVectorStore(interp, objv[2], &store) != TCL_OK) return TCL_ERROR;
+
+    Tcl_Size count, attr_count = 0, cat_count = 0;
+    Tcl_Obj **idObjs, **attrObjs = NULL, **catObjs = NULL;
+    if (Tcl_ListObjGetElements(interp, objv[3], &count, &idObjs) != TCL_OK) return TCL_ERROR;
+
+    for (int i = 5; i < objc; i += 2) {
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &opt) != TCL_OK) return TCL_ERROR;
+        Tcl_Size n;
+        Tcl_Obj **elems;
+        if (Tcl_ListObjGetElements(interp, objv[i + 1], &n, &elems) != TCL_OK) return TCL_ERROR;
+        if (n != count) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("%s has %" TCL_SIZE_MODIFIER "d elements, expected %" TCL_SIZE_MODIFIER "d",
+                                                   Tcl_GetString(objv[i]), n, count));
+            return TCL_ERROR;
+        }
+        if (opt == OPT_ATTRS) { attrObjs = elems; attr_count = n; }
+        else { catObjs = elems; cat_count = n; }
+    }
+
+    Tcl_Size bytes = 0;
+    const float *vectors = (const float *) Tcl_GetByteArrayFromObj(objv[4], &bytes);
+    if (vectors == NULL || (size_t)bytes != (size_t)count * store->dim * sizeof(float)) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("vectors has %" TCL_SIZE_MODIFIER "d bytes, expected %" TCL_SIZE_MODIFIER "d x %d float32",
+                                               bytes, count, store->dim));
+        return TCL_ERROR;
+    }
+
+    // Validar todo antes de tocar el almacén: un add falla entero o entra entero
+    Tcl_WideInt *ids = (Tcl_WideInt *) ckalloc(sizeof(Tcl_WideInt) * (count ? count : 1));
+    float *attrs = (float *) ckalloc(sizeof(float) * (count ? count : 1));
+    for (Tcl_Size r = 0; r < count; r++) {
+        double attr = 0.0;
+        if (Tcl_GetWideIntFromObj(interp, idObjs[r], &ids[r]) != TCL_OK ||
+            (attr_count && Tcl_GetDoubleFromObj(interp, attrObjs[r], &attr) != TCL_OK)) {
+            ckfree((char *)ids);
+            ckfree((char *)attrs);
+            return TCL_ERROR;
+        }
+        attrs[r] = (float)attr;
+    }
+
+    if (StoreGrow(interp, store, count) != TCL_OK) {
+        ckfree((char *)ids);
+        ckfree((char *)attrs);
+        return TCL_ERROR;
+    }
+
+    int dim = store->dim;
+    float *scratch = store->blocked ? (float *) ckalloc(sizeof(float) * dim) : NULL;
+    for (Tcl_Size r = 0; r < count; r++) {
+        Tcl_Size row = store->count + r;
+        const float *src = vectors + (size_t)r * dim;
+        float *dst = store->blocked ? scratch : store->vectors + (size_t)row * dim;
+        float norm = sqrtf(Vec_Dot(src, src, dim));
+        float scale = (norm > 0.0f) ? 1.0f / norm : 0.0f;
+        for (int i = 0; i < dim; i++) dst[i] = src[i] * scale;
+        if (store->blocked) Store_PutRow(store, store->vectors, row, dst);
+        store->ids[row] = ids[r];
+        store->attrs[row] = attrs[r];
+        store->categories[row] = cat_count ? CategoryIndex(store, catObjs[r]) : -1;
+        if (store->categories[row] >= 0) RowList_Push(&store->category_rows[store->categories[row]], row);
+        if (store->nlist) RowList_Push(&store->lists[Ivf_Nearest(store, dst)], row);
+    }
+    store->count += count;
+    Memory_Touch(&store->mem);
+
+    if (scratch) ckfree((char *)scratch);
+    ckfree((char *)ids);
+    ckfree((char *)attrs);
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)store->count));
+    return TCL_OK;
+}
+
+// --- SEARCH ---
+
+typedef struct {
+    float score;
+    Tcl_Size row;
+} Hit;
+
+// Min-heap de tamaño k: la raíz es el peor de los mejores
+static void HeapSiftDown(Hit *heap, int n, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && heap[l].score < heap[m].score) m = l;
+        if (r < n && heap[r].score < heap[m].score) m = r;
+        if (m == i) return;
+        Hit t = heap[i]; heap[i] = heap[m]; heap[m] = t;
+        i = m;
+    }
+}
+
+static void HeapPush(Hit *heap, int *n, int k, float score, Tcl_Size row) {
+    if (*n < k) {
+        int i = (*n)++;
+        heap[i].score = score;
+        heap[i].row = row;
+        while (i > 0 && heap[(i - 1) / 2].score > heap[i].score) {
+            Hit t = heap[i]; heap[i] = heap[(i - 1) / 2]; heap[(i - 1) / 2] = t;
+            i = (i - 1) / 2;
+        }
+    } else if (score > heap[0].score) {
+        heap[0].score = score;
+        heap[0].row = row;
+        HeapSiftDown(heap, *n, 0);
+    }
+}
+
+// Vaciar el heap de atrás hacia adelante deja el arreglo en orden descendente
+static void HeapSortDesc(Hit *heap, int n) {
+    for (int i = n - 1; i > 0; i--) {
+        Hit min = heap[0];
+        heap[0] = heap[i];
+        HeapSiftDown(heap, i, 0);
+        heap[i] = min;
+    }
+}
+
+// Decaimiento y pesos por categoría de una búsqueda
+typedef struct {
+    float neg_decay;
+    float *weights;         // weights[0] es el peso de "sin categoría"
+    int use_weights;
+} Boost;
+
+static int Boost_Init(Tcl_Interp *interp, VectorStore *store, double decay, Tcl_Obj *weightsObj, Boost *boost) {
+    // Peso por índice de categoría; las que no están en el almacén se ignoran
+    Tcl_Size ncat;
+    Tcl_ListObjLength(NULL, store->category_names, &ncat);
+    boost->neg_decay = (float)-decay;
+    boost->weights = (float *) ckalloc(sizeof(float) * (ncat + 1));
+    memset(boost->weights, 0, sizeof(float) * (ncat + 1));
+    boost->use_weights = 0;
+    if (weightsObj == NULL) return TCL_OK;
+
+    Tcl_DictSearch ds;
+    Tcl_Obj *key, *value;
+    int done;
+    if (Tcl_DictObjFirst(interp, weightsObj, &ds, &key, &value, &done) != TCL_OK) {
+        ckfree((char *)boost->weights);
+        return TCL_ERROR;
+    }
+    for (; !done; Tcl_DictObjNext(&ds, &key, &value, &done)) {
+        double w;
+        if (Tcl_GetDoubleFromObj(interp, value, &w) != TCL_OK) {
+            Tcl_DictObjDone(&ds);
+            ckfree((char *)boost->weights);
+            return TCL_ERROR;
+        }
+        Tcl_HashEntry *entry = Tcl_FindHashEntry(&store->category_index, Tcl_GetString(key));
+        if (entry) {
+            boost->weights[(intptr_t)Tcl_GetHashValue(entry) + 1] = (float)w;
+            boost->use_weights = 1;
+        }
+    }
+    return TCL_OK;
+}
+
+// Puntaje fusionado de una fila: similitud, decaimiento y peso
+static inline float Boost_Apply(const Boost *boost, const VectorStore *store, Tcl_Size row, float score) {
+    if (boost->neg_decay != 0.0f) score *= expf(boost->neg_decay * store->attrs[row]);
+    if (boost->use_weights) score += boost->weights[store->categories[row] + 1];
+    return score;
+}
+
+static inline float Boost_Score(const Boost *boost, const VectorStore *store, const float *query, Tcl_Size row) {
+    return Boost_Apply(boost, store, row, Store_Dot(store, query, row));
+}
+
+// Lee la consulta (lista de floats) y la normaliza
+static int QueryFromList(Tcl_Interp *interp, VectorStore *store, Tcl_Obj *listObj, float *query) {
+    Tcl_Size qn;
+    Tcl_Obj **qObjs;
+    if (Tcl_ListObjGetElements(interp, listObj, &qn, &qObjs) != TCL_OK) return TCL_ERROR;
+    if (qn != store->dim) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("query has %" TCL_SIZE_MODIFIER "d dimensions, store has %d", qn, store->dim));
+        return TCL_ERROR;
+    }
+    for (int i = 0; i < store->dim; i++) {
+        double v;
+        if (Tcl_GetDoubleFromObj(interp, qObjs[i], &v) != TCL_OK) return TCL_ERROR;
+        query[i] = (float)v;
+    }
+    float qnorm = sqrtf(Vec_Dot(query, query, store->dim));
+    if (qnorm > 0.0f) {
+        for (int i = 0; i < store->dim; i++) query[i] /= qnorm;
+    }
+    return TCL_OK;
+}
+
+// Barrido completo de un almacén -layout blocked, bloque por bloque. `mask`
+// es la del filtro por categoría (NULL = sin filtro) y se aplica a los
+// puntajes ya calculados. Devuelve las filas que pasaron el filtro.
+static Tcl_Size ScanBlocks(const VectorStore *store, const Boost *boost, const unsigned char *mask,
+                           const float *query, Hit *heap, int *n, int k) {
+    float scores[STORE_BLOCK];
+    Tcl_Size scanned = 0;
+    for (Tcl_Size base = 0; base < store->count; base += STORE_BLOCK) {
+        Vec_DotBlock(query, store->vectors + (size_t)base * store->dim, store->dim, scores);
+        Tcl_Size end = base + STORE_BLOCK < store->count ? base + STORE_BLOCK : store->count;
+        for (Tcl_Size row = base; row < end; row++) {
+            if (mask && !mask[store->categories[row] + 1]) continue;
+            HeapPush(heap, n, k, Boost_Apply(boost, store, row, scores[row - base]), row);
+            scanned++;
+        }
+    }
+    return scanned;
+}
+
+// Top-k sobre todo el almacén; devuelve cuántos hits quedaron en `heap`,
+// ordenados de mejor a peor
+static int ScanAll(const VectorStore *store, const Boost *boost, const float *query, Hit *heap, int k) {
+    int n = 0;
+    if (store->blocked && k > 0) {
+        ScanBlocks(store, boost, NULL, query, heap, &n, k);
+        HeapSortDesc(heap, n);
+        return n;
+    }
+    for (Tcl_Size row = 0; row < store->count && k > 0; row++) {
+        HeapPush(heap, &n, k, Boost_Score(boost, store, query, row), row);
+    }
+    HeapSortDesc(heap, n);
+    return n;
+}
+
+static Tcl_Obj *HitList(const VectorStore *store, const Hit *hits, int n) {
+    Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < n; i++) {
+        Tcl_Obj *pair[2];
+        pair[0] = Tcl_NewWideIntObj(store->ids[hits[i].row]);
+        pair[1] = Tcl_NewDoubleObj(hits[i].score);
+        Tcl_ListObjAppendElement(NULL, list, Tcl_NewListObj(2, pair));
+    }
+    return list;
+}
+
+// --- PLAN ---
+
+static const char *const plan_names[] = {"scan", "subset", "ivf", NULL};
+
+// Costos relativos a un producto punto sobre una fila leída en secuencia
+#define PLAN_GATHER_COST   1.15     // Fila alcanzada por índice (RowList): acceso no secuencial
+#define PLAN_SKIP_COST     0.05     // Fila descartada por el filtro sin puntuarla
+#define PLAN_MIN_MATCHES   4        // IVF con filtro: coincidencias esperadas por cada hit pedido
+
+// Modelo de latencia: peso de la búsqueda más reciente y muestras mínimas
+// antes de confiar en él
+#define MODEL_DECAY        0.05
+#define MODEL_MIN_SAMPLES  8
+
+static void Model_Update(SearchLatencyModel *m, double x, double y) {
+    const double keep = 1.0 - MODEL_DECAY;
+    m->w = m->w * keep + 1.0;
+    m->sx = m->sx * keep + x;
+    m->sy = m->sy * keep + y;
+    m->sxx = m->sxx * keep + x * x;
+    m->sxy = m->sxy * keep + x * y;
+    m->samples++;
+}
+
+// Ajusta a y b; sin variación de costo entre búsquedas recientes (todas con
+// el mismo plan), cae a un modelo proporcional
+static int Model_Fit(const SearchLatencyModel *m, double *a, double *b) {
+    if (m->samples < MODEL_MIN_SAMPLES || m->sx <= 0.0) return 0;
+    double mx = m->sx / m->w, my = m->sy / m->w;
+    double var = m->sxx / m->w - mx * mx;
+    double cov = m->sxy / m->w - mx * my;
+    *a = 0.0;
+    *b = my / mx;
+    if (var > 1e-6 * mx * mx && cov > 0.0) {
+        double slope = cov / var, intercept = my - slope * mx;
+        if (intercept >= 0.0) {
+            *a = intercept;
+            *b = slope;
+        }
+    }
+    return *b > 0.0;
+}
+
+// Filtro por categorías: mask[categoría + 1] (mask[0] = sin categoría)
+typedef struct {
+    int active;
+    unsigned char *mask;
+    int *cats;              // Categorías del filtro que existen en el almacén
+    int ncats;
+    Tcl_Size rows;          // Filas que pasan el filtro
+} Filter;
+
+static int Filter_Init(Tcl_Interp *interp, VectorStore *store, Tcl_Obj *listObj, Filter *filter) {
+    Tcl_Size ncat;
+    Tcl_ListObjLength(NULL, store->category_names, &ncat);
+    memset(filter, 0, sizeof(Filter));
+    filter->rows = store->count;
+    if (listObj == NULL) return TCL_OK;
+
+    Tcl_Size n;
+    Tcl_Obj **names;
+    if (Tcl_ListObjGetElements(interp, listObj, &n, &names) != TCL_OK) return TCL_ERROR;
+    filter->active = 1;
+    filter->mask = (unsigned char *) ckalloc(ncat + 1);
+    memset(filter->mask, 0, ncat + 1);
+    filter->cats = (int *) ckalloc(sizeof(int) * (n ? n : 1));
+    filter->rows = 0;
+    for (Tcl_Size i = 0; i < n; i++) {
+        // Categorías desconocidas no tienen filas: no aportan nada
+        Tcl_HashEntry *entry = Tcl_FindHashEntry(&store->category_index, Tcl_GetString(names[i]));
+        if (entry == NULL) continue;
+        int c = (int)(intptr_t)Tcl_GetHashValue(entry);
+        if (filter->mask[c + 1]) continue;
+        filter->mask[c + 1] = 1;
+        filter->cats[filter->ncats++] = c;
+        filter->rows += store->category_rows[c].count;
+    }
+    return TCL_OK;
+}
+
+static void Filter_Free(Filter *filter) {
+    if (!filter->active) return;
+    ckfree((char *)filter->mask);
+    ckfree((char *)filter->cats);
+}
+
+static inline int Filter_Pass(const Filter *filter, const VectorStore *store, Tcl_Size row) {
+    return !filter->active || filter->mask[store->categories[row] + 1];
+}
+
+// Estima el costo de cada plan y elige el más barato (o el forzado).
+// nprobe < 0 = el del índice, que el planificador sube si con el filtro no
+// quedarían suficientes coincidencias en las listas sondeadas. Con
+// target_ns > 0 y el modelo de IVF calibrado, nprobe es el mayor que entra
+// en el presupuesto (aunque eso baje el recall).
+static int Store_Plan(Tcl_Interp *interp, const VectorStore *store, int k, const Filter *filter,
+                      int nprobe, double target_ns, int forced, StorePlan *plan) {
+    double n = (double)store->count;
+    double s = (n > 0) ? filter->rows / n : 0.0;
+
+    memset(plan, 0, sizeof(StorePlan));
+    plan->selectivity = filter->active ? s : 1.0;
+    plan->target_ns = target_ns;
+    for (int p = 0; p < PLAN_COUNT; p++) plan->cost[p] = -1.0;
+    double a, b;
+    int calibrated = Model_Fit(&store->latency_models[PLAN_IVF], &a, &b);
+
+    plan->cost[PLAN_SCAN] = n * s + n * (1.0 - s) * PLAN_SKIP_COST;
+    if (filter->active) {
+        plan->cost[PLAN_SUBSET] = filter->rows * PLAN_GATHER_COST;
+    }
+    if (store->nlist) {
+        int probe = (nprobe > 0) ? nprobe : store->nprobe;
+        // Costo por lista sondeada (filas que pasan el filtro y descartadas)
+        double per_list = (n / store->nlist) * (s * PLAN_GATHER_COST + (1.0 - s) * PLAN_SKIP_COST);
+        if (nprobe <= 0 && target_ns > 0.0 && calibrated) {
+            double budget = (target_ns - a) / b - store->nlist;
+            double fit = (per_list > 0.0) ? floor(budget / per_list) : store->nlist;
+            probe = (fit < 1.0) ? 1 : (fit >= store->nlist ? store->nlist : (int)fit);
+        } else if (nprobe <= 0 && filter->active && s > 0.0) {
+            double want = (double)PLAN_MIN_MATCHES * k * store->nlist / (n * s);
+            if (want > probe) probe = (want >= store->nlist) ? store->nlist : (int)ceil(want);
+        }
+        if (probe > store->nlist) probe = store->nlist;
+        plan->nprobe = probe;
+        // Sondear todas las listas no ahorra nada frente a un plan exacto
+        if (probe < store->nlist || nprobe > 0) {
+            plan->cost[PLAN_IVF] = store->nlist + probe * per_list;
+        }
+    }
+
+    if (forced >= 0) {
+        if (forced == PLAN_SUBSET && !filter->active) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("plan \"subset\" needs -categories", -1));
+            return TCL_ERROR;
+        }
+        if (forced == PLAN_IVF && store->nlist == 0) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("store has no IVF index; build one with embedding::store index", -1));
+            return TCL_ERROR;
+        }
+        if (forced == PLAN_IVF && plan->cost[PLAN_IVF] < 0) {
+            plan->cost[PLAN_IVF] = store->nlist + n * s * PLAN_GATHER_COST + n * (1.0 - s) * PLAN_SKIP_COST;
+        }
+        plan->kind = (PlanKind)forced;
+    } else {
+        // Con todos los planes elegibles calibrados se compara la latencia
+        // prevista; si no, el costo estimado. Empate: gana el plan exacto
+        // (orden del enum).
+        double predicted[PLAN_COUNT];
+        int by_latency = 1;
+        for (int p = 0; p < PLAN_COUNT; p++) {
+            double pa, pb;
+            predicted[p] = plan->cost[p];
+            if (plan->cost[p] < 0) continue;
+            if (Model_Fit(&store->latency_models[p], &pa, &pb)) predicted[p] = pa + pb * plan->cost[p];
+            else by_latency = 0;
+        }
+        const double *score = by_latency ? predicted : plan->cost;
+        plan->kind = PLAN_SCAN;
+        for (int p = 1; p < PLAN_COUNT; p++) {
+            if (plan->cost[p] >= 0 && score[p] < score[plan->kind]) plan->kind = (PlanKind)p;
+        }
+    }
+    if (Model_Fit(&store->latency_models[plan->kind], &a, &b)) {
+        plan->predicted_ns = a + b * plan->cost[plan->kind];
+    }
+    return TCL_OK;
+}
+
+// Ejecuta el plan; devuelve cuántos hits quedaron en `heap`, de mejor a peor
+static int Store_Execute(const VectorStore *store, StorePlan *plan, const Filter *filter,
+                         const Boost *boost, const float *query, Hit *heap, int k) {
+    int n = 0;
+    Tcl_Size scanned = 0, visited = 0;
+    if (k <= 0) return 0;
+
+    switch (plan->kind) {
+    case PLAN_SCAN:
+        if (store->blocked) {
+            scanned = ScanBlocks(store, boost, filter->active ? filter->mask : NULL, query, heap, &n, k);
+            plan->work = store->count;
+            break;
+        }
+        for (Tcl_Size row = 0; row < store->count; row++) {
+            if (!Filter_Pass(filter, store, row)) continue;
+            HeapPush(heap, &n, k, Boost_Score(boost, store, query, row), row);
+            scanned++;
+        }
+        plan->work = scanned + (store->count - scanned) * PLAN_SKIP_COST;
+        break;
+    case PLAN_SUBSET:
+        for (int i = 0; i < filter->ncats; i++) {
+            const RowList *list = &store->category_rows[filter->cats[i]];
+            for (Tcl_Size j = 0; j < list->count; j++) {
+                HeapPush(heap, &n, k, Boost_Score(boost, store, query, list->rows[j]), list->rows[j]);
+            }
+            scanned += list->count;
+        }
+        plan->work = scanned * PLAN_GATHER_COST;
+        break;
+    case PLAN_IVF: {
+        int *lists = (int *) ckalloc(sizeof(int) * plan->nprobe);
+        int nprobe = Ivf_Probe(store, query, plan->nprobe, lists);
+        for (int i = 0; i < nprobe; i++) {
+            const RowList *list = &store->lists[lists[i]];
+            visited += list->count;
+            for (Tcl_Size j = 0; j < list->count; j++) {
+                Tcl_Size row = list->rows[j];
+                if (!Filter_Pass(filter, store, row)) continue;
+                HeapPush(heap, &n, k, Boost_Score(boost, store, query, row), row);
+                scanned++;
+            }
+        }
+        ckfree((char *)lists);
+        plan->work = store->nlist + scanned * PLAN_GATHER_COST + (visited - scanned) * PLAN_SKIP_COST;
+        break;
+    }
+    default:
+        break;
+    }
+    plan->scanned = scanned;
+    HeapSortDesc(heap, n);
+    return n;
+}
+
+// embedding::store search store query k ?-decay lambda? ?-weights dict?
+//                         ?-categories list? ?-plan auto|scan|subset|ivf? ?-nprobe n?
+//                         ?-target_latency_ms ms?
+// Puntaje: sim * exp(-lambda * attr) + weights(categoría)
+static int StoreSearch(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-decay", "-weights", "-categories", "-plan", "-nprobe", "-target_latency_ms", NULL};
+    enum { OPT_DECAY, OPT_WEIGHTS, OPT_CATEGORIES, OPT_PLAN, OPT_NPROBE, OPT_TARGET };
+    static const char *const plan_options[] = {"scan", "subset", "ivf", "auto", NULL};
+
+    if (objc < 5 || (objc % 2) == 0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "store query k ?-decay lambda? ?-weights dict? ?-categories list? ?-plan auto|scan|subset|ivf? ?-nprobe n? ?-target_latency_ms ms?");
+        return TCL_ERROR;
+    }
+
+    VectorStore *store;
+    int k;
+    if (GetVectorStore(interp, objv[2], &store) != TCL_OK) return TCL_ERROR;
+    if (Tcl_GetIntFromObj(interp, objv[4], &k) != TCL_OK) return TCL_ERROR;
+    if (k <= 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("k must be > 0", -1));
+        return TCL_ERROR;
+    }
+
+    double decay = 0.0, target_ms = 0.0;
+    Tcl_Obj *weightsObj = NULL, *categoriesObj = NULL;
+    int forced = PLAN_COUNT, nprobe = -1;
+    for (int i = 5; i < objc; i += 2) {
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &opt) != TCL_OK) return TCL_ERROR;
+        switch (opt) {
+        case OPT_DECAY:
+            if (Tcl_GetDoubleFromObj(interp, objv[i + 1], &decay) != TCL_OK) return TCL_ERROR;
+            break;
+        case OPT_WEIGHTS:
+            weightsObj = objv[i + 1];
+            break;
+        case OPT_CATEGORIES:
+            categoriesObj = objv[i + 1];
+            break;
+        case OPT_PLAN:
+            if (Tcl_GetIndexFromObj(interp, objv[i + 1], plan_options, "plan", 0, &forced) != TCL_OK) return TCL_ERROR;
+            break;
+        case OPT_NPROBE:
+            if (Tcl_GetIntFromObj(interp, objv[i + 1], &nprobe) != TCL_OK) return TCL_ERROR;
+            if (nprobe <= 0) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("nprobe must be > 0", -1));
+                return TCL_ERROR;
+            }
+            break;
+        case OPT_TARGET:
+            if (Tcl_GetDoubleFromObj(interp, objv[i + 1], &target_ms) != TCL_OK) return TCL_ERROR;
+            if (target_ms <= 0.0) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("target_latency_ms must be > 0", -1));
+                return TCL_ERROR;
+            }
+            break;
+        }
+    }
+    if (forced == PLAN_COUNT) forced = -1;   // "auto"
+
+    Filter filter;
+    if (Filter_Init(interp, store, categoriesObj, &filter) != TCL_OK) return TCL_ERROR;
+    StorePlan plan;
+    if (Store_Plan(interp, store, k, &filter, nprobe, target_ms * 1e6, forced, &plan) != TCL_OK) {
+        Filter_Free(&filter);
+        return TCL_ERROR;
+    }
+
+    float *query = (float *) ckalloc(sizeof(float) * store->dim);
+    if (QueryFromList(interp, store, objv[3], query) != TCL_OK) {
+        ckfree((char *)query);
+        Filter_Free(&filter);
+        return TCL_ERROR;
+    }
+    Boost boost;
+    if (Boost_Init(interp, store, decay, weightsObj, &boost) != TCL_OK) {
+        ckfree((char *)query);
+        Filter_Free(&filter);
+        return TCL_ERROR;
+    }
+
+    if ((Tcl_Size)k > filter.rows) k = (int)filter.rows;
+    Hit *heap = (Hit *) ckalloc(sizeof(Hit) * (k ? k : 1));
+    uint64_t start = Latency_Now();
+    int n = Store_Execute(store, &plan, &filter, &boost, query, heap, k);
+    plan.elapsed_ns = Latency_Now() - start;
+    if (plan.work > 0.0) Model_Update(&store->latency_models[plan.kind], plan.work, (double)plan.elapsed_ns);
+    store->last_plan = plan;
+    store->plan_counts[plan.kind]++;
+    Memory_Touch(&store->mem);
+    Tcl_SetObjResult(interp, HitList(store, heap, n));
+
+    ckfree((char *)heap);
+    ckfree((char *)query);
+    ckfree((char *)boost.weights);
+    Filter_Free(&filter);
+    return TCL_OK;
+}
+
+// --- REFINE ---
+
+// Rocchio: q' = alpha*q + beta*media(pos) - gamma*media(neg), normalizado
+void Vec_Rocchio(float *query, int dim, float alpha,
+                 float beta, const float *const *pos, int npos,
+                 float gamma, const float *const *neg, int nneg) {
+    if (alpha != 1.0f) {
+        for (int i = 0; i < dim; i++) query[i] *= alpha;
+    }
+    if (npos > 0 && beta != 0.0f) {
+        for (int j = 0; j < npos; j++) Vec_Axpy(query, beta / npos, pos[j], dim);
+    }
+    if (nneg > 0 && gamma != 0.0f) {
+        for (int j = 0; j < nneg; j++) Vec_Axpy(query, -gamma / nneg, neg[j], dim);
+    }
+    float norm = sqrtf(Vec_Dot(query, query, dim));
+    if (norm > 0.0f) {
+        float scale = 1.0f / norm;
+        for (int i = 0; i < dim; i++) query[i] *= scale;
+    }
+}
+
+// Lee una lista de blobs float32 de `dim` dimensiones
+static int BlobList(Tcl_Interp *interp, Tcl_Obj *listObj, int dim, const float ***vecsPtr, Tcl_Size *countPtr) {
+    Tcl_Size count;
+    Tcl_Obj **elems;
+    if (Tcl_ListObjGetElements(interp, listObj, &count, &elems) != TCL_OK) return TCL_ERROR;
+    const float **vecs = (const float **) ckalloc(sizeof(float *) * (count ? count : 1));
+    for (Tcl_Size j = 0; j < count; j++) {
+        Tcl_Size bytes = 0;
+        vecs[j] = (const float *) Tcl_GetByteArrayFromObj(elems[j], &bytes);
+        if (vecs[j] == NULL || (size_t)bytes != (size_t)dim * sizeof(float)) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("blob %" TCL_SIZE_MODIFIER "d has %" TCL_SIZE_MODIFIER "d bytes, expected %d float32",
+                                                   j, bytes, dim));
+            ckfree((char *)vecs);
+            return TCL_ERROR;
+        }
+    }
+    *vecsPtr = vecs;
+    *countPtr = count;
+    return TCL_OK;
+}
+
+// embedding::refine query_blob hit_blobs ?-alpha a? ?-beta b? ?-gamma g? ?-negatives blobs?
+// Blobs float32 nativos (la columna embedding o compute_batch -format
+// binary); devuelve la consulta refinada como blob normalizado
+int TclEmbedding_Refine_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-alpha", "-beta", "-gamma", "-negatives", NULL};
+    enum { OPT_ALPHA, OPT_BETA, OPT_GAMMA, OPT_NEGATIVES };
+
+    if (objc < 3 || (objc % 2) == 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "query_blob hit_blobs ?-alpha a? ?-beta b? ?-gamma g? ?-negatives blobs?");
+        return TCL_ERROR;
+    }
+
+    double coef[3] = {1.0, 0.75, 0.15};
+    Tcl_Obj *negObj = NULL;
+    for (int i = 3; i < objc; i += 2) {
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &opt) != TCL_OK) return TCL_ERROR;
+        if (opt == OPT_NEGATIVES) {
+            negObj = objv[i + 1];
+        } else if (Tcl_GetDoubleFromObj(interp, objv[i + 1], &coef[opt]) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+
+    Tcl_Size bytes = 0;
+    const float *q = (const float *) Tcl_GetByteArrayFromObj(objv[1], &bytes);
+    if (q == NULL || bytes == 0 || bytes % sizeof(float) != 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("query has %" TCL_SIZE_MODIFIER "d bytes, expected float32 values", bytes));
+        return TCL_ERROR;
+    }
+    int dim = (int)(bytes / sizeof(float));
+
+    const float **pos = NULL, **neg = NULL;
+    Tcl_Size npos = 0, nneg = 0;
+    if (BlobList(interp, objv[2], dim, &pos, &npos) != TCL_OK) return TCL_ERROR;
+    if (negObj && BlobList(interp, negObj, dim, &neg, &nneg) != TCL_OK) {
+        ckfree((char *)pos);
+        return TCL_ERROR;
+    }
+
+    Tcl_Obj *result = Tcl_NewByteArrayObj(NULL, bytes);
+    float *out = (float *) Tcl_GetByteArrayFromObj(result, NULL);
+    memcpy(out, q, (size_t)bytes);
+    Vec_Rocchio(out, dim, (float)coef[OPT_ALPHA],
+                (float)coef[OPT_BETA], pos, (int)npos,
+                (float)coef[OPT_GAMMA], neg, (int)nneg);
+    Tcl_SetObjResult(interp, result);
+
+    ckfree((char *)pos);
+    if (neg) ckfree((char *)neg);
+    return TCL_OK;
+}
+
+// embedding::store refine store query k ?-candidates c? ?-feedback m?
+//                         ?-alpha a? ?-beta b? ?-gamma g? ?-decay lambda? ?-weights dict?
+// Dos rondas con un solo barrido: la primera ronda guarda los c mejores
+// candidatos; los m primeros son la realimentación positiva y los m últimos
+// la negativa (solo con gamma > 0). La segunda ronda reordena únicamente
+// esos candidatos con la consulta refinada.
+static int StoreRefine(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-alpha", "-beta", "-gamma", "-candidates", "-feedback", "-decay", "-weights", NULL};
+    enum { OPT_ALPHA, OPT_BETA, OPT_GAMMA, OPT_CANDIDATES, OPT_FEEDBACK, OPT_DECAY, OPT_WEIGHTS };
+
+    if (objc < 5 || (objc % 2) == 0) {
+        Tcl_WrongNumArgs(interp, 2, objv, "store query k ?-candidates c? ?-feedback m? ?-alpha a? ?-beta b? ?-gamma g? ?-decay lambda? ?-weights dict?");
+        return TCL_ERROR;
+    }
+
+    VectorStore *store;
+    int k;
+    if (GetVectorStore(interp, objv[2], &store) != TCL_OK) return TCL_ERROR;
+    if (Tcl_GetIntFromObj(interp, objv[4], &k) != TCL_OK) return TCL_ERROR;
+    if (k <= 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("k must be > 0", -1));
+        return TCL_ERROR;
+    }
+
+    double coef[3] = {1.0, 0.75, 0.15};
+    double decay = 0.0;
+    int candidates = 100, feedback = 5;
+    Tcl_Obj *weightsObj = NULL;
+    for (int i = 5; i < objc; i += 2) {
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &opt) != TCL_OK) return TCL_ERROR;
+        switch (opt) {
+        case OPT_ALPHA:
+        case OPT_BETA:
+        case OPT_GAMMA:
+            if (Tcl_GetDoubleFromObj(interp, objv[i + 1], &coef[opt]) != TCL_OK) return TCL_ERROR;
+            break;
+        case OPT_CANDIDATES:
+        case OPT_FEEDBACK: {
+            int v;
+            if (Tcl_GetIntFromObj(interp, objv[i + 1], &v) != TCL_OK) return TCL_ERROR;
+            if (v <= 0) {
+                Tcl_SetObjResult(interp, Tcl_ObjPrintf("%s must be > 0", Tcl_GetString(objv[i])));
+                return TCL_ERROR;
+            }
+            if (opt == OPT_CANDIDATES) candidates = v;
+            else feedback = v;
+            break;
+        }
+        case OPT_DECAY:
+            if (Tcl_GetDoubleFromObj(interp, objv[i + 1], &decay) != TCL_OK) return TCL_ERROR;
+            break;
+        case OPT_WEIGHTS:
+            weightsObj = objv[i + 1];
+            break;
+        }
+    }
+
+    int dim = store->dim;
+    float *query = (float *) ckalloc(sizeof(float) * dim);
+    if (QueryFromList(interp, store, objv[3], query) != TCL_OK) {
+        ckfree((char *)query);
+        return TCL_ERROR;
+    }
+    Boost boost;
+    if (Boost_Init(interp, store, decay, weightsObj, &boost) != TCL_OK) {
+        ckfree((char *)query);
+        return TCL_ERROR;
+    }
+
+    if (candidates < k) candidates = k;
+    if ((Tcl_Size)candidates > store->count) candidates = (int)store->count;
+    Hit *cand = (Hit *) ckalloc(sizeof(Hit) * (candidates ? candidates : 1));
+    int nc = ScanAll(store, &boost, query, cand, candidates);
+
+    // Ronda 1 -> realimentación. Con pocos candidatos los positivos tienen
+    // prioridad y los negativos no se solapan con ellos.
+    int npos = feedback < nc ? feedback : nc;
+    int nneg = (coef[OPT_GAMMA] != 0.0) ? (feedback < nc - npos ? feedback : nc - npos) : 0;
+    const float **fb = (const float **) ckalloc(sizeof(float *) * (npos + nneg + 1));
+    float *rows = store->blocked ? (float *) ckalloc(sizeof(float) * dim * (npos + nneg + 1)) : NULL;
+    for (int j = 0; j < npos; j++) {
+        fb[j] = Store_Row(store, cand[j].row, rows ? rows + (size_t)j * dim : NULL);
+    }
+    for (int j = 0; j < nneg; j++) {
+        fb[npos + j] = Store_Row(store, cand[nc - 1 - j].row, rows ? rows + (size_t)(npos + j) * dim : NULL);
+    }
+    Vec_Rocchio(query, dim, (float)coef[OPT_ALPHA],
+                (float)coef[OPT_BETA], fb, npos,
+                (float)coef[OPT_GAMMA], fb + npos, nneg);
+
+    // Ronda 2: solo los candidatos
+    if (k > nc) k = nc;
+    Hit *heap = (Hit *) ckalloc(sizeof(Hit) * (k ? k : 1));
+    int n = 0;
+    for (int j = 0; j < nc; j++) {
+        HeapPush(heap, &n, k, Boost_Score(&boost, store, query, cand[j].row), cand[j].row);
+    }
+    HeapSortDesc(heap, n);
+    Memory_Touch(&store->mem);
+    Tcl_SetObjResult(interp, HitList(store, heap, n));
+
+    ckfree((char *)heap);
+    ckfree((char *)fb);
+    if (rows) ckfree((char *)rows);
+    ckfree((char *)cand);
+    ckfree((char *)query);
+    ckfree((char *)boost.weights);
+    return TCL_OK;
+}
+
+// --- INFO ---
+static int StoreInfo(Tcl_Interp *interp, VectorStore *store) {
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("dim", -1), Tcl_NewIntObj(store->dim));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("layout", -1), Tcl_NewStringObj(store->blocked ? "blocked" : "rows", -1));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("count", -1), Tcl_NewWideIntObj((Tcl_WideInt)store->count));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("capacity", -1), Tcl_NewWideIntObj((Tcl_WideInt)store->capacity));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("bytes", -1), Tcl_NewWideIntObj((Tcl_WideInt)store->mem.bytes));
+    // Copia: CategoryIndex agrega a la lista del store, que no puede quedar compartida
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("categories", -1), Tcl_DuplicateObj(store->category_names));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("nlist", -1), Tcl_NewIntObj(store->nlist));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("nprobe", -1), Tcl_NewIntObj(store->nprobe));
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+// --- STATS ---
+// Planes elegidos hasta ahora, el detalle del último (costos estimados de
+// cada plan elegible, selectividad, filas puntuadas, latencia prevista y
+// real) y el modelo de latencia de cada plan
+static int StoreStats(Tcl_Interp *interp, VectorStore *store) {
+    Tcl_Obj *counts = Tcl_NewDictObj();
+    for (int p = 0; p < PLAN_COUNT; p++) {
+        Tcl_DictObjPut(NULL, counts, Tcl_NewStringObj(plan_names[p], -1), Tcl_NewWideIntObj(store->plan_counts[p]));
+    }
+
+    Tcl_Obj *last = Tcl_NewDictObj();
+    const StorePlan *plan = &store->last_plan;
+    Tcl_WideInt searches = 0;
+    for (int p = 0; p < PLAN_COUNT; p++) searches += store->plan_counts[p];
+    if (searches > 0) {
+        Tcl_Obj *costs = Tcl_NewDictObj();
+        for (int p = 0; p < PLAN_COUNT; p++) {
+            if (plan->cost[p] < 0) continue;
+            Tcl_DictObjPut(NULL, costs, Tcl_NewStringObj(plan_names[p], -1), Tcl_NewDoubleObj(plan->cost[p]));
+        }
+        Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("plan", -1), Tcl_NewStringObj(plan_names[plan->kind], -1));
+        Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("cost", -1), Tcl_NewDoubleObj(plan->cost[plan->kind]));
+        Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("costs", -1), costs);
+        Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("selectivity", -1), Tcl_NewDoubleObj(plan->selectivity));
+        if (plan->kind == PLAN_IVF) {
+            Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("nprobe", -1), Tcl_NewIntObj(plan->nprobe));
+        }
+        Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("scanned", -1), Tcl_NewWideIntObj((Tcl_WideInt)plan->scanned));
+        if (plan->target_ns > 0.0) {
+            Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("target_ms", -1), Tcl_NewDoubleObj(plan->target_ns / 1e6));
+        }
+        if (plan->predicted_ns > 0.0) {
+            Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("predicted_ms", -1), Tcl_NewDoubleObj(plan->predicted_ns / 1e6));
+        }
+        Tcl_DictObjPut(NULL, last, Tcl_NewStringObj("elapsed_ms", -1), Tcl_NewDoubleObj(plan->elapsed_ns / 1e6));
+    }
+
+    Tcl_Obj *models = Tcl_NewDictObj();
+    for (int p = 0; p < PLAN_COUNT; p++) {
+        Tcl_Obj *model = Tcl_NewDictObj();
+        double a, b;
+        Tcl_DictObjPut(NULL, model, Tcl_NewStringObj("samples", -1), Tcl_NewWideIntObj(store->latency_models[p].samples));
+        if (Model_Fit(&store->latency_models[p], &a, &b)) {
+            Tcl_DictObjPut(NULL, model, Tcl_NewStringObj("intercept_ns", -1), Tcl_NewDoubleObj(a));
+            Tcl_DictObjPut(NULL, model, Tcl_NewStringObj("ns_per_cost", -1), Tcl_NewDoubleObj(b));
+        }
+        Tcl_DictObjPut(NULL, models, Tcl_NewStringObj(plan_names[p], -1), model);
+    }
+
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("plans", -1), counts);
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("last", -1), last);
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("latency_models", -1), models);
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+// --- INDEX ---
+// embedding::store index store nlist ?-iterations n? ?-sample n? ?-nprobe n?
+// nlist 0 elimina el índice
+static int StoreIndex(Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-iterations", "-sample", "-nprobe", NULL};
+    enum { OPT_ITERATIONS, OPT_SAMPLE, OPT_NPROBE };
+
+    if (objc < 4 || (objc % 2) == 1) {
+        Tcl_WrongNumArgs(interp, 2, objv, "store nlist ?-iterations n? ?-sample n? ?-nprobe n?");
+        return TCL_ERROR;
+    }
+
+    VectorStore *store;
+    int nlist;
+    if (GetVectorStore(interp, objv[2], &store) != TCL_OK) return TCL_ERROR;
+    if (Tcl_GetIntFromObj(interp, objv[3], &nlist) != TCL_OK) return TCL_ERROR;
+    if (nlist < 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("nlist must be >= 0", -1));
+        return TCL_ERROR;
+    }
+
+    int values[3] = {10, -1, -1};
+    for (int i = 4; i < objc; i += 2) {
+        int opt;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &opt) != TCL_OK) return TCL_ERROR;
+        if (Tcl_GetIntFromObj(interp, objv[i + 1], &values[opt]) != TCL_OK) return TCL_ERROR;
+        if (values[opt] <= 0) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("%s must be > 0", Tcl_GetString(objv[i])));
+            return TCL_ERROR;
+        }
+    }
+
+    if (nlist == 0) {
+        Ivf_Free(store);
+        return TCL_OK;
+    }
+    // Por omisión, 64 filas de muestra por lista
+    Tcl_Size sample = (values[OPT_SAMPLE] > 0) ? values[OPT_SAMPLE] : (Tcl_Size)nlist * 64;
+    if (Ivf_Build(interp, store, nlist, values[OPT_ITERATIONS], sample) != TCL_OK) return TCL_ERROR;
+    if (values[OPT_NPROBE] > 0) {
+        store->nprobe = values[OPT_NPROBE] < nlist ? values[OPT_NPROBE] : nlist;
+    }
+    Memory_Touch(&store->mem);
+    return StoreInfo(interp, store);
+}
+
+// --- REORDER ---
+// embedding::store reorder store
+// Renumera las filas en el orden de Ivf_Order. Sin reordenar, las filas de
+// una lista IVF están desparramadas por todo el almacén en orden de
+// inserción: cada fila sondeada es un salto de caché y, en almacenes
+// grandes, de página. Reordenadas, sondear una lista es leer un tramo
+// contiguo. ids[] es la tabla fila -> id, así que los resultados no cambian.
+// Las filas que se agreguen después van al final; conviene repetirlo tras
+// cargas grandes.
+static int StoreReorder(Tcl_Interp *interp, VectorStore *store) {
+    if (store->nlist == 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("store has no IVF index (see embedding::store index)", -1));
+        return TCL_ERROR;
+    }
+
+    // Durante la copia conviven dos juegos de arreglos
+    size_t copy_bytes = (size_t)store->capacity * RowBytes(store);
+    if (Memory_ReserveOrError(interp, &store->mem, copy_bytes) != TCL_OK) return TCL_ERROR;
+
+    Tcl_Size count = store->count, capacity = store->capacity;
+    int dim = store->dim;
+    Tcl_Size *order = (Tcl_Size *) ckalloc(sizeof(Tcl_Size) * (count ? count : 1));
+    Ivf_Order(store, order);
+
+    // Lista de cada fila, para rearmar las listas con los números nuevos
+    int *list_of = (int *) ckalloc(sizeof(int) * (count ? count : 1));
+    for (int c = 0; c < store->nlist; c++) {
+        const RowList *list = &store->lists[c];
+        for (Tcl_Size j = 0; j < list->count; j++) list_of[list->rows[j]] = c;
+    }
+
+    float *vectors = (float *) ckalloc((size_t)capacity * dim * sizeof(float));
+    Tcl_WideInt *ids = (Tcl_WideInt *) ckalloc((size_t)capacity * sizeof(Tcl_WideInt));
+    float *attrs = (float *) ckalloc((size_t)capacity * sizeof(float));
+    int *categories = (int *) ckalloc((size_t)capacity * sizeof(int));
+    int *lists = (int *) ckalloc(sizeof(int) * (count ? count : 1));
+    float *scratch = store->blocked ? (float *) ckalloc(sizeof(float) * dim) : NULL;
+    if (store->blocked) memset(vectors, 0, (size_t)capacity * dim * sizeof(float));
+    for (Tcl_Size row = 0; row < count; row++) {
+        Tcl_Size old = order[row];
+        Store_PutRow(store, vectors, row, Store_Row(store, old, scratch));
+        ids[row] = store->ids[old];
+        attrs[row] = store->attrs[old];
+        categories[row] = store->categories[old];
+        lists[row] = list_of[old];
+    }
+
+    ckfree((char *)store->vectors);
+    ckfree((char *)store->ids);
+    ckfree((char *)store->attrs);
+    ckfree((char *)store->categories);
+    store->vectors = vectors;
+    store->ids = ids;
+    store->attrs = attrs;
+    store->categories = categories;
+
+    // Recorrer las filas nuevas en orden deja cada lista ordenada
+    for (int c = 0; c < store->category_capacity; c++) store->category_rows[c].count = 0;
+    for (int c = 0; c < store->nlist; c++) store->lists[c].count = 0;
+    for (Tcl_Size row = 0; row < count; row++) {
+        if (categories[row] >= 0) RowList_Push(&store->category_rows[categories[row]], row);
+        RowList_Push(&store->lists[lists[row]], row);
+    }
+
+    if (scratch) ckfree((char *)scratch);
+    ckfree((char *)lists);
+    ckfree((char *)list_of);
+    ckfree((char *)order);
+    Memory_Release(&store->mem, copy_bytes);
+    Memory_Touch(&store->mem);
+    return StoreInfo(interp, store);
+}
+
+// --- STORE ---
+// embedding::store create dim ?-layout rows|blocked?
+// embedding::store add store ids vectors ?-attrs list? ?-categories list?
+// embedding::store search store query k ?-decay lambda? ?-weights dict? ?-categories list? ?...?
+// embedding::store refine store query k ?-candidates c? ?-feedback m? ?...?
+// embedding::store index store nlist ?-iterations n? ?-sample n? ?-nprobe n?
+// embedding::store reorder store
+// embedding::store info store
+// embedding::store stats store
+// embedding::store free store
+int TclEmbedding_Store_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const subcommands[] = {"create", "add", "search", "refine", "index", "reorder", "info", "stats", "free", NULL};
+    enum { SUB_CREATE, SUB_ADD, SUB_SEARCH, SUB_REFINE, SUB_INDEX, SUB_REORDER, SUB_INFO, SUB_STATS, SUB_FREE };
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?arg ...?");
+        return TCL_ERROR;
+    }
+    int sub;
+    if (Tcl_GetIndexFromObj(interp, objv[1], subcommands, "subcommand", 0, &sub) != TCL_OK) return TCL_ERROR;
+
+    switch (sub) {
+    case SUB_CREATE:
+        return StoreCreate(interp, objc, objv);
+    case SUB_ADD:
+        return StoreAdd(interp, objc, objv);
+    case SUB_SEARCH:
+        return StoreSearch(interp, objc, objv);
+    case SUB_REFINE:
+        return StoreRefine(interp, objc, objv);
+    case SUB_INDEX:
+        return StoreIndex(interp, objc, objv);
+    case SUB_REORDER:
+    case SUB_INFO:
+    case SUB_STATS:
+    case SUB_FREE: {
+        if (objc != 3) {
+            Tcl_WrongNumArgs(interp, 2, objv, "store");
+            return TCL_ERROR;
+        }
+        VectorStore *store;
+        if (GetVectorStore(interp, objv[2], &store) != TCL_OK) return TCL_ERROR;
+        if (sub == SUB_REORDER) return StoreReorder(interp, store);
+        if (sub == SUB_INFO) return StoreInfo(interp, store);
+        if (sub == SUB_STATS) return StoreStats(interp, store);
+        // Borrar el comando del handle dispara VectorStore_Delete
+        Tcl_DeleteCommand(interp, Tcl_GetString(objv[2]));
+        return TCL_OK;
+    }
+    }
+    return TCL_ERROR;
+}
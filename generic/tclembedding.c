@@ -9,203 +9,1117 @@
 extern "C" {
 #endif
 
-#include <tcl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include "onnxruntime_c_api.h"
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tclembeddingInt.h"
 
-// Estructura de estado
-typedef struct {
-    OrtSession* session;
-    OrtSessionOptions* options;
-    OrtEnv* env;
-    int embedding_dim;
-} EmbeddingState;
+const OrtApi* g_ort = NULL;
 
-static const OrtApi* g_ort = NULL;
+// Ids de handle: nunca se reutilizan aunque malloc repita la dirección
+static uint64_t g_next_state_id = 0;
 
-// Macro para verificar errores de ONNX en Init (donde no hay cleanup complejo)
+// Contenedor de pesos pre-empaquetados compartido por todas las sesiones del
+// proceso: los handles que cargan el mismo modelo reutilizan sus inicializadores.
+TCL_DECLARE_MUTEX(g_prepacked_mutex)
+static OrtPrepackedWeightsContainer* g_prepacked = NULL;
+static int g_prepacked_refs = 0;
+
+// Macro para verificar errores de ONNX en Init (libera el estado a medio armar)
 #define CHECK_STATUS_INIT(expr) do { \
     OrtStatus* status = (expr); \
     if (status != NULL) { \
         const char* msg = g_ort->GetErrorMessage(status); \
         Tcl_SetObjResult(interp, Tcl_NewStringObj(msg, -1)); \
         g_ort->ReleaseStatus(status); \
+        EmbeddingState_Delete(state); \
         return TCL_ERROR; \
     } \
 } while(0)
 
+// Mensaje de error en memoria propia: los hilos de reload no tienen intérprete
+static char *ErrorString(const char *fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    char *msg = ckalloc(strlen(buf) + 1);
+    strcpy(msg, buf);
+    return msg;
+}
+
+static char *StatusString(OrtStatus *st) {
+    char *msg = ErrorString("%s", g_ort->GetErrorMessage(st));
+    g_ort->ReleaseStatus(st);
+    return msg;
+}
+
+// --- MMAP ---
+// Mapea el modelo en solo lectura y compartido: las páginas viven en el page
+// cache y las reutilizan todos los procesos que cargan el mismo archivo.
+static char *MapModelFile(const char *path, void **out, size_t *out_len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return ErrorString("cannot open model \"%s\": %s", path, strerror(errno));
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+        close(fd);
+        return ErrorString("cannot stat model \"%s\"", path);
+    }
+
+    void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return ErrorString("cannot mmap model \"%s\": %s", path, strerror(errno));
+    }
+    madvise(map, (size_t)sb.st_size, MADV_WILLNEED);
+
+    *out = map;
+    *out_len = (size_t)sb.st_size;
+    return NULL;
+}
+
+static OrtPrepackedWeightsContainer* AcquirePrepackedWeights(void) {
+    Tcl_MutexLock(&g_prepacked_mutex);
+    if (g_prepacked == NULL) {
+        OrtStatus* st = g_ort->CreatePrepackedWeightsContainer(&g_prepacked);
+        if (st) { g_ort->ReleaseStatus(st); g_prepacked = NULL; }
+    }
+    if (g_prepacked) g_prepacked_refs++;
+    OrtPrepackedWeightsContainer* c = g_prepacked;
+    Tcl_MutexUnlock(&g_prepacked_mutex);
+    return c;
+}
+
+static void ReleasePrepackedWeights(void) {
+    Tcl_MutexLock(&g_prepacked_mutex);
+    if (g_prepacked && --g_prepacked_refs == 0) {
+        g_ort->ReleasePrepackedWeightsContainer(g_prepacked);
+        g_prepacked = NULL;
+    }
+    Tcl_MutexUnlock(&g_prepacked_mutex);
+}
+
+// --- METADATOS DEL MODELO ---
+// Valor de una entrada de metadata_props (ckalloc), NULL si no está
+static char *ModelMetadata(OrtSession *session, const char *key) {
+    OrtModelMetadata *meta = NULL;
+    OrtAllocator *alloc = NULL;
+    char *value = NULL, *copy = NULL;
+
+    OrtStatus *st = g_ort->SessionGetModelMetadata(session, &meta);
+    if (st) {
+        g_ort->ReleaseStatus(st);
+        return NULL;
+    }
+    st = g_ort->GetAllocatorWithDefaultOptions(&alloc);
+    if (!st) st = g_ort->ModelMetadataLookupCustomMetadataMap(meta, alloc, key, &value);
+    if (st) {
+        g_ort->ReleaseStatus(st);
+    } else if (value) {
+        copy = ckalloc(strlen(value) + 1);
+        strcpy(copy, value);
+        g_ort->AllocatorFree(alloc, value);
+    }
+    g_ort->ReleaseModelMetadata(meta);
+    return copy;
+}
+
+static int ModelHasOutput(OrtSession *session, const char *name) {
+    OrtAllocator *alloc = NULL;
+    size_t count = 0;
+    int found = 0;
+
+    OrtStatus *st = g_ort->GetAllocatorWithDefaultOptions(&alloc);
+    if (!st) st = g_ort->SessionGetOutputCount(session, &count);
+    for (size_t i = 0; !st && !found && i < count; i++) {
+        char *output = NULL;
+        st = g_ort->SessionGetOutputName(session, i, alloc, &output);
+        if (st) break;
+        found = strcmp(output, name) == 0;
+        g_ort->AllocatorFree(alloc, output);
+    }
+    if (st) g_ort->ReleaseStatus(st);
+    return found;
+}
+
+// --- POOLING EN EL GRAFO ---
+// tools/bake_pooling marca el modelo con tclembedding.pooling = mean_l2 y
+// agrega la salida sentence_embedding {B, D}, ya promediada y normalizada.
+static int ModelHasGraphPooling(OrtSession *session) {
+    char *value = ModelMetadata(session, "tclembedding.pooling");
+    int found = value && strcmp(value, "mean_l2") == 0;
+    if (value) ckfree(value);
+    return found;
+}
+
+// --- EMPAQUETADO ---
+// Para empaquetar varios textos en una fila el modelo tiene que aceptar una
+// máscara por par de tokens (attention_mask {B, T, T}, bloque-diagonal) y
+// position_ids, que reinician en cada segmento. Los exports estándar de
+// HuggingFace traen attention_mask {B, T} y no califican.
+static int ModelAcceptsPacking(OrtSession *session) {
+    OrtAllocator *alloc = NULL;
+    size_t count = 0;
+    int mask3 = 0, positions = 0;
+
+    OrtStatus *st = g_ort->GetAllocatorWithDefaultOptions(&alloc);
+    if (!st) st = g_ort->SessionGetInputCount(session, &count);
+    for (size_t i = 0; !st && i < count; i++) {
+        char *name = NULL;
+        st = g_ort->SessionGetInputName(session, i, alloc, &name);
+        if (st) break;
+        if (strcmp(name, "position_ids") == 0) {
+            positions = 1;
+        } else if (strcmp(name, "attention_mask") == 0) {
+            OrtTypeInfo *type = NULL;
+            const OrtTensorTypeAndShapeInfo *info = NULL;
+            size_t rank = 0;
+            st = g_ort->SessionGetInputTypeInfo(session, i, &type);
+            if (!st) st = g_ort->CastTypeInfoToTensorInfo(type, &info);
+            if (!st) st = g_ort->GetDimensionsCount(info, &rank);
+            if (type) g_ort->ReleaseTypeInfo(type);
+            mask3 = !st && rank == 3;
+        }
+        g_ort->AllocatorFree(alloc, name);
+    }
+    if (st) {
+        g_ort->ReleaseStatus(st);
+        return 0;
+    }
+    return mask3 && positions;
+}
+
+// --- MODELO ---
+// Sesión de ONNX Runtime y lo que vive con ella. Cada Run toma una
+// referencia: embedding::reload cambia el modelo de un handle aunque haya
+// Runs en curso sobre el anterior, que se libera con el último de ellos.
+struct EmbeddingModel {
+    OrtSession* session;
+    void* model_map;        // Mapeo del .onnx (-mmap 1), vive lo mismo que la sesión
+    size_t model_map_len;
+    size_t bytes;           // Reservado en la cuenta del handle; se devuelve al liberar
+    char* path;
+    int pooled_in_graph;    // Modelo reescrito con tools/bake_pooling: sentence_embedding {B, D}
+    int packable;           // attention_mask {B, T, T} + position_ids: admite compute_batch -pack
+    int layers;             // Capa de la que salen los vectores, 0 = la última
+    char hidden_name[32];   // Salida con el estado oculto: last_hidden_state o hidden_states.N
+    int refs;               // El handle + cada Run en curso (model_mutex)
+};
+
+static void Model_Free(EmbeddingState *state, EmbeddingModel *model) {
+    if (model->session) g_ort->ReleaseSession(model->session);
+    if (model->model_map) munmap(model->model_map, model->model_map_len);
+    Memory_Release(&state->mem, model->bytes);
+    ckfree(model->path);
+    ckfree((char *)model);
+}
+
+static EmbeddingModel *Model_Acquire(EmbeddingState *state) {
+    Tcl_MutexLock(&state->model_mutex);
+    EmbeddingModel *model = state->model;
+    model->refs++;
+    Tcl_MutexUnlock(&state->model_mutex);
+    return model;
+}
+
+static void Model_Release(EmbeddingState *state, EmbeddingModel *model) {
+    Tcl_MutexLock(&state->model_mutex);
+    int last = --model->refs == 0;
+    Tcl_MutexUnlock(&state->model_mutex);
+    if (last) Model_Free(state, model);
+}
+
+// --- SALIDA TEMPRANA ---
+// init_raw -layers N lee el estado oculto de la capa N en vez del último.
+// Dos formas de modelo sirven: uno recortado en la capa N con
+// tools/bake_pooling -layers N (metadata tclembedding.layers = N; su
+// last_hidden_state ya es esa capa y las siguientes no se ejecutan), o uno
+// exportado con las salidas intermedias hidden_states.N (mismos pesos, pero
+// ORT sigue ejecutando el encoder completo). Deja en model->hidden_name la
+// salida a leer y en model->layers la capa; devuelve NULL o el error.
+static char *ModelSelectLayer(EmbeddingModel *model, int layers) {
+    char *value = ModelMetadata(model->session, "tclembedding.layers");
+    int cut = value ? atoi(value) : 0;
+    if (value) ckfree(value);
+
+    strcpy(model->hidden_name, "last_hidden_state");
+    model->layers = cut;
+    if (layers == 0 || layers == cut) return NULL;
+    if (cut) return ErrorString("model \"%s\" is cut at layer %d, not %d", model->path, cut, layers);
+
+    snprintf(model->hidden_name, sizeof(model->hidden_name), "hidden_states.%d", layers);
+    if (!ModelHasOutput(model->session, model->hidden_name)) {
+        return ErrorString("model \"%s\" has no output %s (cut it with tools/bake_pooling -layers %d)",
+                           model->path, model->hidden_name, layers);
+    }
+    // sentence_embedding promedia la última capa: se agrupa en el host
+    model->pooled_in_graph = 0;
+    model->layers = layers;
+    return NULL;
+}
+
+// Crea la sesión con las opciones del handle. `bytes` ya está reservado en
+// la cuenta del handle y pasa a ser del modelo (también si falla). Con
+// `share_prepacked` usa el contenedor de pesos pre-empaquetados del proceso.
+// Devuelve NULL o el mensaje de error (ckalloc).
+static char *Model_Load(EmbeddingState *state, const char *path, size_t bytes, int share_prepacked,
+                        EmbeddingModel **modelPtr) {
+    OrtPrepackedWeightsContainer *prepacked = share_prepacked ? state->prepacked : NULL;
+    EmbeddingModel *model = (EmbeddingModel *) ckalloc(sizeof(EmbeddingModel));
+    memset(model, 0, sizeof(EmbeddingModel));
+    model->bytes = bytes;
+    model->refs = 1;
+    model->path = ckalloc(strlen(path) + 1);
+    strcpy(model->path, path);
+
+    char *error = NULL;
+    OrtStatus *status;
+    if (state->use_mmap) {
+        // ORT usa los bytes del mapeo sin copiarlos (en modelos formato .ort
+        // los inicializadores apuntan directo al mapeo), por eso el mapeo
+        // debe sobrevivir a la sesión.
+        error = MapModelFile(path, &model->model_map, &model->model_map_len);
+        if (error) goto fail;
+        status = prepacked
+            ? g_ort->CreateSessionFromArrayWithPrepackedWeightsContainer(state->env, model->model_map, model->model_map_len, state->options, prepacked, &model->session)
+            : g_ort->CreateSessionFromArray(state->env, model->model_map, model->model_map_len, state->options, &model->session);
+    } else {
+        status = prepacked
+            ? g_ort->CreateSessionWithPrepackedWeightsContainer(state->env, path, state->options, prepacked, &model->session)
+            : g_ort->CreateSession(state->env, path, state->options, &model->session);
+    }
+    if (status != NULL) {
+        model->session = NULL;
+        error = StatusString(status);
+        goto fail;
+    }
+
+    model->pooled_in_graph = ModelHasGraphPooling(model->session);
+    model->packable = ModelAcceptsPacking(model->session);
+    error = ModelSelectLayer(model, state->layers);
+    if (error) goto fail;
+    *modelPtr = model;
+    return NULL;
+
+fail:
+    Model_Free(state, model);
+    return error;
+}
+
+static void Reload_Finish(EmbeddingState *state);
+
+// Libera todo lo que cuelga de un handle (llamado al borrar su comando)
+static void EmbeddingState_Delete(ClientData cd) {
+    EmbeddingState *state = (EmbeddingState *) cd;
+    // Una carga en curso usa el estado: se espera a que termine
+    if (state->reload) Reload_Finish(state);
+    if (state->model) Model_Release(state, state->model);
+    if (state->reload_error) ckfree(state->reload_error);
+    Tcl_MutexFinalize(&state->model_mutex);
+    if (state->prepacked) ReleasePrepackedWeights();
+    if (state->options) g_ort->ReleaseSessionOptions(state->options);
+    if (state->env) g_ort->ReleaseEnv(state->env);
+    Projection_Free(state->projection);
+    Latency_Free(state);
+    Memory_Unregister(&state->mem);
+    ckfree((char *)state);
+}
+
+// El handle es un comando solo para atar la vida del estado a la del intérprete
+static int EmbeddingHandle_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    Tcl_SetObjResult(interp, Tcl_ObjPrintf("\"%s\" is an embedding handle; use embedding::compute", Tcl_GetString(objv[0])));
+    return TCL_ERROR;
+}
+
+// Resuelve un handle devuelto por init_raw a su estado
+int GetEmbeddingState(Tcl_Interp *interp, Tcl_Obj *handle, EmbeddingState **statePtr) {
+    Tcl_CmdInfo info;
+    if (!Tcl_GetCommandInfo(interp, Tcl_GetString(handle), &info) || info.deleteProc != EmbeddingState_Delete) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("invalid embedding handle \"%s\"", Tcl_GetString(handle)));
+        return TCL_ERROR;
+    }
+    *statePtr = (EmbeddingState *) info.objClientData;
+    return TCL_OK;
+}
+
 // --- INIT ---
 static int TclEmbedding_Init_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-layers", "-mmap", "-projection", "-threads", NULL};
+    enum { OPT_LAYERS, OPT_MMAP, OPT_PROJECTION, OPT_THREADS };
+
     if (g_ort == NULL) g_ort = OrtGetApiBase()->GetApi(ORT_API_VERSION);
     
-    if (objc != 2) {
-        Tcl_WrongNumArgs(interp, 1, objv, "model_path");
+    if (objc < 2 || (objc % 2) != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "model_path ?-layers n? ?-mmap bool? ?-projection file? ?-threads n?");
         return TCL_ERROR;
     }
 
+    int use_mmap = 0;
+    const char *projection_path = NULL;
+    int intra_threads = 1;
+    int layers = 0;
+    for (int i = 2; i < objc; i += 2) {
+        int idx;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &idx) != TCL_OK) return TCL_ERROR;
+        switch (idx) {
+        case OPT_LAYERS:
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &layers) != TCL_OK) return TCL_ERROR;
+            if (layers < 0) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("-layers must be >= 0", -1));
+                return TCL_ERROR;
+            }
+            break;
+        case OPT_MMAP:
+            if (Tcl_GetBooleanFromObj(interp, objv[i+1], &use_mmap) != TCL_OK) return TCL_ERROR;
+            break;
+        case OPT_PROJECTION:
+            projection_path = Tcl_GetString(objv[i+1]);
+            break;
+        case OPT_THREADS:
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &intra_threads) != TCL_OK) return TCL_ERROR;
+            if (intra_threads < 1) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("-threads must be >= 1", -1));
+                return TCL_ERROR;
+            }
+            break;
+        }
+    }
+
     const char *model_path = Tcl_GetString(objv[1]);
     EmbeddingState *state = (EmbeddingState *) ckalloc(sizeof(EmbeddingState));
+    memset(state, 0, sizeof(EmbeddingState));
+    state->id = __atomic_add_fetch(&g_next_state_id, 1, __ATOMIC_RELAXED);
+
+    char handle[64];
+    snprintf(handle, sizeof(handle), "embedding%p", (void *)state);
+    Memory_Register(&state->mem, MEM_MODEL, handle, NULL, state);
+
+    // Los pesos se cargan enteros: se cobran al presupuesto antes de crear la sesión
+    struct stat sb;
+    size_t model_bytes = stat(model_path, &sb) == 0 ? (size_t)sb.st_size : 0;
+    if (Memory_ReserveOrError(interp, &state->mem, model_bytes) != TCL_OK) {
+        EmbeddingState_Delete(state);
+        return TCL_ERROR;
+    }
+    
+    if (projection_path) {
+        if (Projection_Load(interp, projection_path, &state->projection) != TCL_OK ||
+            Memory_ReserveOrError(interp, &state->mem, Projection_Bytes(state->projection)) != TCL_OK) {
+            EmbeddingState_Delete(state);
+            return TCL_ERROR;
+        }
+    }
     
     // Inicialización paso a paso
     CHECK_STATUS_INIT(g_ort->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "tclembedding", &state->env));
     CHECK_STATUS_INIT(g_ort->CreateSessionOptions(&state->options));
-    CHECK_STATUS_INIT(g_ort->SetIntraOpNumThreads(state->options, 1));
+    CHECK_STATUS_INIT(g_ort->SetIntraOpNumThreads(state->options, intra_threads));
     CHECK_STATUS_INIT(g_ort->SetSessionExecutionMode(state->options, ORT_SEQUENTIAL));
+    if (use_mmap) {
+        CHECK_STATUS_INIT(g_ort->AddSessionConfigEntry(state->options, "session.use_ort_model_bytes_directly", "1"));
+        CHECK_STATUS_INIT(g_ort->AddSessionConfigEntry(state->options, "session.use_ort_model_bytes_for_initializers", "1"));
+    }
+    state->use_mmap = use_mmap;
+    state->layers = layers;
+    state->prepacked = AcquirePrepackedWeights();
 
-    OrtStatus* status = g_ort->CreateSession(state->env, model_path, state->options, &state->session);
-    if (status != NULL) {
-        const char* msg = g_ort->GetErrorMessage(status);
-        Tcl_SetObjResult(interp, Tcl_NewStringObj(msg, -1));
-        g_ort->ReleaseStatus(status);
-        ckfree((char *)state);
+    char *error = Model_Load(state, model_path, model_bytes, 1, &state->model);
+    if (error) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(error, -1));
+        ckfree(error);
+        EmbeddingState_Delete(state);
         return TCL_ERROR;
     }
-
     state->embedding_dim = 384; // MiniLM-L12
 
-    char handle[64];
-    snprintf(handle, sizeof(handle), "embedding%p", (void *)state);
-    Tcl_CreateObjCommand(interp, handle, NULL, state, NULL);
+    Tcl_CreateObjCommand(interp, handle, EmbeddingHandle_Cmd, state, EmbeddingState_Delete);
     Tcl_SetObjResult(interp, Tcl_NewStringObj(handle, -1));
     return TCL_OK;
 }
 
 // --- COMPUTE ---
-static int TclEmbedding_Compute_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
-    if (objc != 3) {
-        Tcl_WrongNumArgs(interp, 1, objv, "handle token_id_list");
-        return TCL_ERROR;
+
+// Texto dentro de una fila empaquetada: tokens [start, start + len) de `row`
+typedef struct {
+    Tcl_Size row;
+    Tcl_Size start;
+    Tcl_Size len;
+} PackSegment;
+
+// Lote de entrada {batch, seq_len}, con padding a la derecha (attention = 0).
+// Empaquetado, cada fila lleva varios textos: attention es {batch, seq_len,
+// seq_len} bloque-diagonal y hay un segmento por texto.
+typedef struct {
+    Tcl_Size batch;
+    Tcl_Size seq_len;
+    Tcl_Size count;         // Textos (= filas salvo empaquetado)
+    int64_t* input_ids;
+    int64_t* attention;
+    int64_t* type_ids;
+    int64_t* position_ids;  // Solo empaquetado
+    PackSegment* segments;  // Solo empaquetado, uno por texto en el orden de entrada
+} EmbeddingBatch;
+
+static void EmbeddingBatch_Free(EmbeddingBatch *b) {
+    if (b->input_ids) ckfree((char*)b->input_ids);
+    if (b->attention) ckfree((char*)b->attention);
+    if (b->type_ids) ckfree((char*)b->type_ids);
+    if (b->position_ids) ckfree((char*)b->position_ids);
+    if (b->segments) ckfree((char*)b->segments);
+    memset(b, 0, sizeof(EmbeddingBatch));
+}
+
+// Arma el lote a partir de `count` listas de ids de token
+static int EmbeddingBatch_FromLists(Tcl_Interp *interp, Tcl_Size count, Tcl_Obj *const lists[], EmbeddingBatch *b) {
+    memset(b, 0, sizeof(EmbeddingBatch));
+    b->batch = count;
+    b->count = count;
+
+    for (Tcl_Size r = 0; r < count; r++) {
+        Tcl_Size len;
+        if (Tcl_ListObjLength(interp, lists[r], &len) != TCL_OK) return TCL_ERROR;
+        if (len == 0) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("empty token list at index %" TCL_SIZE_MODIFIER "d", r));
+            return TCL_ERROR;
+        }
+        if (len > b->seq_len) b->seq_len = len;
     }
 
-    const char *handle = Tcl_GetString(objv[1]);
-    Tcl_CmdInfo info;
-    if (!Tcl_GetCommandInfo(interp, handle, &info)) return TCL_ERROR;
-    EmbeddingState *state = (EmbeddingState *) info.objClientData;
+    size_t cells = (size_t)count * (size_t)b->seq_len;
+    b->input_ids = (int64_t*)ckalloc(cells * sizeof(int64_t));
+    b->attention = (int64_t*)ckalloc(cells * sizeof(int64_t));
+    b->type_ids  = (int64_t*)ckalloc(cells * sizeof(int64_t));
+    memset(b->input_ids, 0, cells * sizeof(int64_t));
+    memset(b->attention, 0, cells * sizeof(int64_t));
+    memset(b->type_ids, 0, cells * sizeof(int64_t));
 
-    // 1. TCL List -> C Array
-    int token_count;
-    Tcl_Obj **obj_tokens;
-    if (Tcl_ListObjGetElements(interp, objv[2], &token_count, &obj_tokens) != TCL_OK) return TCL_ERROR;
+    for (Tcl_Size r = 0; r < count; r++) {
+        Tcl_Size token_count;
+        Tcl_Obj **obj_tokens;
+        Tcl_ListObjGetElements(NULL, lists[r], &token_count, &obj_tokens);
+        size_t row = (size_t)r * (size_t)b->seq_len;
+        for (Tcl_Size i = 0; i < token_count; i++) {
+            Tcl_WideInt val;
+            if (Tcl_GetWideIntFromObj(interp, obj_tokens[i], &val) != TCL_OK) {
+                EmbeddingBatch_Free(b);
+                return TCL_ERROR;
+            }
+            b->input_ids[row + i] = (int64_t)val;
+            b->attention[row + i] = 1;
+        }
+    }
+    return TCL_OK;
+}
 
-    if (token_count == 0) {
-        Tcl_SetObjResult(interp, Tcl_NewListObj(0, NULL));
-        return TCL_OK;
+// Orden del empaquetado: más largos primero, empates por orden de entrada
+typedef struct {
+    Tcl_Size len;
+    Tcl_Size index;
+} PackItem;
+
+static int PackLongerFirst(const void *a, const void *b) {
+    const PackItem *x = (const PackItem *)a, *y = (const PackItem *)b;
+    if (x->len != y->len) return x->len < y->len ? 1 : -1;
+    return x->index < y->index ? -1 : 1;
+}
+
+// Arma un lote empaquetado: first-fit decreasing de los textos en filas de
+// hasta max_len tokens (un texto más largo ocupa una fila para él solo;
+// con max_len 0, cada texto).
+// Cada segmento sólo se atiende a sí mismo y sus posiciones arrancan en 0,
+// así que la salida por texto es la misma que sin empaquetar.
+static int EmbeddingBatch_Pack(Tcl_Interp *interp, Tcl_Size count, Tcl_Obj *const lists[], Tcl_Size max_len, EmbeddingBatch *b) {
+    memset(b, 0, sizeof(EmbeddingBatch));
+    b->count = count;
+
+    PackItem *order = (PackItem *)ckalloc(count * sizeof(PackItem));
+    Tcl_Size *fill = (Tcl_Size *)ckalloc(count * sizeof(Tcl_Size));
+    for (Tcl_Size r = 0; r < count; r++) {
+        if (Tcl_ListObjLength(interp, lists[r], &order[r].len) != TCL_OK) goto fail;
+        if (order[r].len == 0) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("empty token list at index %" TCL_SIZE_MODIFIER "d", r));
+            goto fail;
+        }
+        order[r].index = r;
     }
+    qsort(order, count, sizeof(PackItem), PackLongerFirst);
+
+    b->segments = (PackSegment *)ckalloc(count * sizeof(PackSegment));
+    for (Tcl_Size k = 0; k < count; k++) {
+        Tcl_Size r = order[k].index, len = order[k].len, row = 0;
+        while (row < b->batch && fill[row] + len > max_len) row++;
+        if (row == b->batch) fill[b->batch++] = 0;
+        b->segments[r].row = row;
+        b->segments[r].start = fill[row];
+        b->segments[r].len = len;
+        fill[row] += len;
+        if (fill[row] > b->seq_len) b->seq_len = fill[row];
+    }
+
+    size_t cells = (size_t)b->batch * (size_t)b->seq_len;
+    size_t pairs = cells * (size_t)b->seq_len;
+    b->input_ids = (int64_t*)ckalloc(cells * sizeof(int64_t));
+    b->type_ids = (int64_t*)ckalloc(cells * sizeof(int64_t));
+    b->position_ids = (int64_t*)ckalloc(cells * sizeof(int64_t));
+    b->attention = (int64_t*)ckalloc(pairs * sizeof(int64_t));
+    memset(b->input_ids, 0, cells * sizeof(int64_t));
+    memset(b->type_ids, 0, cells * sizeof(int64_t));
+    memset(b->position_ids, 0, cells * sizeof(int64_t));
+    memset(b->attention, 0, pairs * sizeof(int64_t));
 
-    int64_t* input_ids = (int64_t*)ckalloc(token_count * sizeof(int64_t));
-    int64_t* attention = (int64_t*)ckalloc(token_count * sizeof(int64_t));
-    int64_t* type_ids  = (int64_t*)ckalloc(token_count * sizeof(int64_t));
+    // El padding se atiende a sí mismo: una fila de máscara toda en cero da
+    // NaN en el softmax, y el pooling lo ignora igual
+    for (size_t c = 0; c < cells; c++) b->attention[c * b->seq_len + c % b->seq_len] = 1;
 
-    for (int i = 0; i < token_count; i++) {
-        long val;
-        Tcl_GetLongFromObj(interp, obj_tokens[i], &val);
-        input_ids[i] = (int64_t)val;
-        attention[i] = 1; 
-        type_ids[i] = 0;
+    for (Tcl_Size r = 0; r < count; r++) {
+        const PackSegment *seg = &b->segments[r];
+        Tcl_Size token_count;
+        Tcl_Obj **obj_tokens;
+        Tcl_ListObjGetElements(NULL, lists[r], &token_count, &obj_tokens);
+        size_t row = (size_t)seg->row * (size_t)b->seq_len;
+        for (Tcl_Size i = 0; i < token_count; i++) {
+            Tcl_WideInt val;
+            if (Tcl_GetWideIntFromObj(interp, obj_tokens[i], &val) != TCL_OK) goto fail;
+            size_t t = row + seg->start + i;
+            b->input_ids[t] = (int64_t)val;
+            b->position_ids[t] = i;
+            int64_t *mask = b->attention + t * b->seq_len;
+            for (Tcl_Size j = 0; j < seg->len; j++) mask[seg->start + j] = 1;
+        }
     }
 
-    // Variables para ONNX y limpieza
+    ckfree((char *)order);
+    ckfree((char *)fill);
+    return TCL_OK;
+
+fail:
+    ckfree((char *)order);
+    ckfree((char *)fill);
+    EmbeddingBatch_Free(b);
+    return TCL_ERROR;
+}
+
+// Los modelos con máscara {B, T, T} la necesitan siempre: sin -pack
+// (max_len 0) el lote empaquetado lleva un texto por fila
+static int EmbeddingBatch_Build(Tcl_Interp *interp, const EmbeddingModel *model, Tcl_Size count, Tcl_Obj *const lists[],
+                                Tcl_Size pack, EmbeddingBatch *b) {
+    if (model->packable) return EmbeddingBatch_Pack(interp, count, lists, pack, b);
+    return EmbeddingBatch_FromLists(interp, count, lists, b);
+}
+
+// Corre el modelo sobre el lote y deja en *pooledPtr (batch x dim doubles,
+// ckalloc) el mean pooling enmascarado + normalización L2 de cada fila.
+// `model` es el que armó el lote, tomado con Model_Acquire.
+static int EmbedBatch(Tcl_Interp *interp, EmbeddingState *state, const EmbeddingModel *model, EmbeddingBatch *b,
+                      StageTimer *timer, double **pooledPtr) {
     OrtMemoryInfo* memory_info = NULL;
     OrtStatus* st = NULL;
-    OrtValue *t1 = NULL, *t2 = NULL, *t3 = NULL, *t_out = NULL;
-    double* sum_vec = NULL;
+    OrtValue *t1 = NULL, *t2 = NULL, *t3 = NULL, *t4 = NULL, *t_out = NULL;
+    OrtTensorTypeAndShapeInfo* out_info = NULL;
     int result = TCL_OK;
+    int packed = b->segments != NULL;
+    // Empaquetado no sirve sentence_embedding (promedia la fila entera)
+    int graph_pooling = model->pooled_in_graph && !packed;
+    size_t cells = (size_t)b->batch * (size_t)b->seq_len;
+
+#define ORT_FAIL(st) do { \
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(g_ort->GetErrorMessage(st), -1)); \
+        g_ort->ReleaseStatus(st); \
+        result = TCL_ERROR; \
+        goto cleanup; \
+    } while (0)
 
     // 2. Preparar Memoria y Tensores
     st = g_ort->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &memory_info);
-    if (st) { g_ort->ReleaseStatus(st); result = TCL_ERROR; goto cleanup_early; }
-    
-    int64_t input_shape[] = {1, token_count};
-    
-    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, input_ids, token_count*8, input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t1);
-    if (st) { g_ort->ReleaseStatus(st); result = TCL_ERROR; goto cleanup; }
+    if (st) ORT_FAIL(st);
+
+    int64_t input_shape[] = {b->batch, b->seq_len};
+    int64_t mask_shape[] = {b->batch, b->seq_len, b->seq_len};
+    size_t mask_cells = packed ? cells * (size_t)b->seq_len : cells;
+
+    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, b->input_ids, cells*8, input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t1);
+    if (st) ORT_FAIL(st);
 
-    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, attention, token_count*8, input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t2);
-    if (st) { g_ort->ReleaseStatus(st); result = TCL_ERROR; goto cleanup; }
+    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, b->attention, mask_cells*8, packed ? mask_shape : input_shape, packed ? 3 : 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t2);
+    if (st) ORT_FAIL(st);
 
-    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, type_ids, token_count*8, input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t3);
-    if (st) { g_ort->ReleaseStatus(st); result = TCL_ERROR; goto cleanup; }
+    st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, b->type_ids, cells*8, input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t3);
+    if (st) ORT_FAIL(st);
 
-    const char* input_names[] = {"input_ids", "attention_mask", "token_type_ids"};
-    const char* output_names[] = {"last_hidden_state"};
-    const OrtValue* inputs[] = {t1, t2, t3};
+    if (packed) {
+        st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, b->position_ids, cells*8, input_shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &t4);
+        if (st) ORT_FAIL(st);
+    }
+    TCLEMB_PROBE2(tensor__build, b->batch, b->seq_len);
+    StageTimer_Mark(timer, STAGE_TENSOR);
+
+    const char* input_names[] = {"input_ids", "attention_mask", "token_type_ids", "position_ids"};
+    const char* output_names[] = {graph_pooling ? "sentence_embedding" : model->hidden_name};
+    const OrtValue* inputs[] = {t1, t2, t3, t4};
 
     // 3. Ejecutar Inferencia
-    st = g_ort->Run(state->session, NULL, input_names, inputs, 3, output_names, 1, &t_out);
-    if (st) {
-        const char* msg = g_ort->GetErrorMessage(st);
-        Tcl_SetObjResult(interp, Tcl_NewStringObj(msg, -1));
-        g_ort->ReleaseStatus(st);
+    TCLEMB_PROBE2(run__entry, b->batch, b->seq_len);
+    st = g_ort->Run(model->session, NULL, input_names, inputs, packed ? 4 : 3, output_names, 1, &t_out);
+    TCLEMB_PROBE3(run__exit, b->batch, b->seq_len, st != NULL);
+    StageTimer_Mark(timer, STAGE_RUN);
+    if (st) ORT_FAIL(st);
+
+    // La dimensión sale del tensor ({B, T, D}, o {B, D} si el grafo ya hace
+    // el pooling), no de la configuración
+    int64_t out_shape[3] = {0, 0, 0};
+    size_t out_dims = 0;
+    size_t want_dims = graph_pooling ? 2 : 3;
+    st = g_ort->GetTensorTypeAndShape(t_out, &out_info);
+    if (st) ORT_FAIL(st);
+    st = g_ort->GetDimensionsCount(out_info, &out_dims);
+    if (st) ORT_FAIL(st);
+    if (out_dims != want_dims) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("unexpected %s rank %d (expected %d)",
+                                               output_names[0], (int)out_dims, (int)want_dims));
         result = TCL_ERROR;
         goto cleanup;
     }
+    st = g_ort->GetDimensions(out_info, out_shape, out_dims);
+    if (st) ORT_FAIL(st);
+    int dim = (int)out_shape[out_dims - 1];
+    state->embedding_dim = dim;
+
+    // El arena de ORT crece hasta el tensor de activaciones más grande visto
+    // (con pooling en el grafo last_hidden_state sigue existiendo adentro)
+    size_t activation_bytes = cells * (size_t)dim * sizeof(float);
+    if (activation_bytes > state->activation_peak) {
+        Memory_Charge(&state->mem, activation_bytes - state->activation_peak);
+        state->activation_peak = activation_bytes;
+    }
 
     // 4. Mean Pooling + L2 Normalization
     float* floats;
-    // --- EL FIX DEL WARNING ESTÁ AQUÍ ---
     st = g_ort->GetTensorMutableData(t_out, (void**)&floats);
-    if (st) {
-        const char* msg = g_ort->GetErrorMessage(st);
-        Tcl_SetObjResult(interp, Tcl_NewStringObj(msg, -1));
-        g_ort->ReleaseStatus(st);
-        result = TCL_ERROR;
-        goto cleanup;
-    }
-    // ------------------------------------
-    
-    sum_vec = (double*)calloc(state->embedding_dim, sizeof(double));
-    if (!sum_vec) { result = TCL_ERROR; goto cleanup; }
+    if (st) ORT_FAIL(st);
+
+    TCLEMB_PROBE2(pool__start, b->seq_len, dim);
+    double *pooled = (double*)ckalloc((size_t)b->count * dim * sizeof(double));
+    if (graph_pooling) {
+        // El grafo ya promedió y normalizó: solo se copia
+        for (size_t i = 0; i < (size_t)b->batch * dim; i++) pooled[i] = floats[i];
+    } else {
+        for (Tcl_Size r = 0; r < b->count; r++) {
+            // Sin empaquetar un texto es una fila; empaquetado, su segmento
+            Tcl_Size row = packed ? b->segments[r].row : r;
+            Tcl_Size first = packed ? b->segments[r].start : 0;
+            Tcl_Size end = packed ? first + b->segments[r].len : b->seq_len;
+            double *sum_vec = pooled + (size_t)r * dim;
+            const int64_t *mask = packed ? NULL : b->attention + (size_t)row * b->seq_len;
+            const float *hidden = floats + (size_t)row * b->seq_len * dim;
+            Tcl_Size used = 0;
+            memset(sum_vec, 0, dim * sizeof(double));
 
-    // A. Sumar
-    for (int t = 0; t < token_count; t++) {
-        for (int i = 0; i < state->embedding_dim; i++) {
-            sum_vec[i] += floats[t * state->embedding_dim + i];
+            // A. Sumar (solo tokens reales, el padding no cuenta)
+            for (Tcl_Size t = first; t < end; t++) {
+                if (mask && !mask[t]) continue;
+                used++;
+                for (int i = 0; i < dim; i++) {
+                    sum_vec[i] += hidden[(size_t)t * dim + i];
+                }
+            }
+
+            // B. Promediar y Calcular Norma
+            double norm = 0.0;
+            for (int i = 0; i < dim; i++) {
+                sum_vec[i] /= used;
+                norm += sum_vec[i] * sum_vec[i];
+            }
+            norm = sqrt(norm);
+            if (norm < 1e-9) norm = 1e-9;
+            for (int i = 0; i < dim; i++) sum_vec[i] /= norm;
         }
     }
-    
-    // B. Promediar y Calcular Norma
-    double norm = 0.0;
-    for (int i = 0; i < state->embedding_dim; i++) {
-        sum_vec[i] /= token_count;
-        norm += sum_vec[i] * sum_vec[i];
-    }
-    norm = sqrt(norm);
-    if (norm < 1e-9) norm = 1e-9;
 
-    // C. Generar lista TCL normalizada
-    Tcl_Obj *result_list = Tcl_NewListObj(0, NULL);
-    for (int i = 0; i < state->embedding_dim; i++) {
-        Tcl_ListObjAppendElement(interp, result_list, Tcl_NewDoubleObj(sum_vec[i] / norm));
+    // C. Proyección PCA (GEMV) + renormalización
+    if (state->projection) {
+        if (Projection_InDim(state->projection) != dim) {
+            ckfree((char*)pooled);
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("projection expects %d dimensions, model outputs %d",
+                                                   Projection_InDim(state->projection), dim));
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        int out_dim = Projection_OutDim(state->projection);
+        double *projected = (double*)ckalloc((size_t)b->count * out_dim * sizeof(double));
+        Projection_Apply(state->projection, pooled, projected, b->count);
+        ckfree((char*)pooled);
+        pooled = projected;
+        dim = out_dim;
+        state->embedding_dim = dim;
     }
-    Tcl_SetObjResult(interp, result_list);
+    TCLEMB_PROBE2(pool__end, b->seq_len, dim);
+    StageTimer_Mark(timer, STAGE_POOL);
+    *pooledPtr = pooled;
 
 cleanup:
-    if (sum_vec) free(sum_vec);
+    if (out_info) g_ort->ReleaseTensorTypeAndShapeInfo(out_info);
     if (t1) g_ort->ReleaseValue(t1);
     if (t2) g_ort->ReleaseValue(t2);
     if (t3) g_ort->ReleaseValue(t3);
+    if (t4) g_ort->ReleaseValue(t4);
     if (t_out) g_ort->ReleaseValue(t_out);
     if (memory_info) g_ort->ReleaseMemoryInfo(memory_info);
+    return result;
+#undef ORT_FAIL
+}
+
+static int TclEmbedding_Compute_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "handle token_id_list");
+        return TCL_ERROR;
+    }
 
-cleanup_early:
-    ckfree((char*)input_ids);
-    ckfree((char*)attention);
-    ckfree((char*)type_ids);
+    EmbeddingState *state;
+    if (GetEmbeddingState(interp, objv[1], &state) != TCL_OK) return TCL_ERROR;
 
-    return result;
+    StageTimer timer;
+    StageTimer_Start(&timer, state);
+
+    // 1. TCL List -> C Array
+    Tcl_Size token_count;
+    if (Tcl_ListObjLength(interp, objv[2], &token_count) != TCL_OK) return TCL_ERROR;
+    if (token_count == 0) {
+        Tcl_SetObjResult(interp, Tcl_NewListObj(0, NULL));
+        return TCL_OK;
+    }
+
+    // El modelo queda tomado hasta el final del Run aunque un reload lo reemplace
+    EmbeddingModel *model = Model_Acquire(state);
+    TCLEMB_PROBE1(tokenize__start, token_count);
+    EmbeddingBatch batch;
+    int result = EmbeddingBatch_Build(interp, model, 1, &objv[2], 0, &batch);
+    TCLEMB_PROBE1(tokenize__end, token_count);
+    StageTimer_Mark(&timer, STAGE_TOKENIZE);
+
+    double *pooled = NULL;
+    if (result == TCL_OK) {
+        result = EmbedBatch(interp, state, model, &batch, &timer, &pooled);
+        EmbeddingBatch_Free(&batch);
+    }
+    Model_Release(state, model);
+    if (result != TCL_OK) return result;
+
+    // C. Generar lista TCL normalizada
+    int dim = state->embedding_dim;
+    TCLEMB_PROBE1(marshal__start, dim);
+    Tcl_Obj *result_list = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < dim; i++) {
+        Tcl_ListObjAppendElement(interp, result_list, Tcl_NewDoubleObj(pooled[i]));
+    }
+    Tcl_SetObjResult(interp, result_list);
+    TCLEMB_PROBE1(marshal__end, dim);
+    StageTimer_Mark(&timer, STAGE_MARSHAL);
+    StageTimer_Total(&timer);
+
+    ckfree((char*)pooled);
+    return TCL_OK;
+}
+
+// --- COMPUTE BATCH ---
+// embedding::compute_batch handle list_of_token_id_lists ?-format list|binary? ?-pack max_len?
+// -format binary devuelve un bytearray de batch x dim float32 (nativos, como
+// `binary format f*`); en Tcl 9 puede pasar de 2 GB.
+// -pack junta textos cortos en filas de hasta max_len tokens (0 = sin
+// empaquetar); sólo con modelos que aceptan máscara {B, T, T} y position_ids.
+static int TclEmbedding_ComputeBatch_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-format", "-pack", NULL};
+    static const char *const formats[] = {"list", "binary", NULL};
+    enum { OPT_FORMAT, OPT_PACK };
+    enum { FORMAT_LIST, FORMAT_BINARY };
+
+    if (objc < 3 || (objc % 2) != 1) {
+        Tcl_WrongNumArgs(interp, 1, objv, "handle token_id_lists ?-format list|binary? ?-pack max_len?");
+        return TCL_ERROR;
+    }
+
+    int format = FORMAT_LIST;
+    int pack = 0;
+    for (int i = 3; i < objc; i += 2) {
+        int idx;
+        if (Tcl_GetIndexFromObj(interp, objv[i], options, "option", 0, &idx) != TCL_OK) return TCL_ERROR;
+        switch (idx) {
+        case OPT_FORMAT:
+            if (Tcl_GetIndexFromObj(interp, objv[i+1], formats, "format", 0, &format) != TCL_OK) return TCL_ERROR;
+            break;
+        case OPT_PACK:
+            if (Tcl_GetIntFromObj(interp, objv[i+1], &pack) != TCL_OK) return TCL_ERROR;
+            if (pack < 0) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj("-pack must be >= 0", -1));
+                return TCL_ERROR;
+            }
+            break;
+        }
+    }
+
+    EmbeddingState *state;
+    if (GetEmbeddingState(interp, objv[1], &state) != TCL_OK) return TCL_ERROR;
+
+    StageTimer timer;
+    StageTimer_Start(&timer, state);
+
+    Tcl_Size count;
+    Tcl_Obj **lists;
+    if (Tcl_ListObjGetElements(interp, objv[2], &count, &lists) != TCL_OK) return TCL_ERROR;
+    if (count == 0) {
+        Tcl_SetObjResult(interp, format == FORMAT_BINARY ? Tcl_NewByteArrayObj(NULL, 0) : Tcl_NewListObj(0, NULL));
+        return TCL_OK;
+    }
+
+    EmbeddingModel *model = Model_Acquire(state);
+    if (pack && !model->packable) {
+        Model_Release(state, model);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("model does not accept packed batches (needs a {B, T, T} attention_mask and a position_ids input)", -1));
+        return TCL_ERROR;
+    }
+
+    TCLEMB_PROBE1(tokenize__start, count);
+    EmbeddingBatch batch;
+    int result = EmbeddingBatch_Build(interp, model, count, lists, pack, &batch);
+    TCLEMB_PROBE1(tokenize__end, count);
+    StageTimer_Mark(&timer, STAGE_TOKENIZE);
+
+    double *pooled = NULL;
+    if (result == TCL_OK) {
+        result = EmbedBatch(interp, state, model, &batch, &timer, &pooled);
+        EmbeddingBatch_Free(&batch);
+    }
+    Model_Release(state, model);
+    if (result != TCL_OK) return result;
+
+    int dim = state->embedding_dim;
+    size_t values = (size_t)count * dim;
+    TCLEMB_PROBE1(marshal__start, dim);
+    if (format == FORMAT_BINARY) {
+        if (values * sizeof(float) > (size_t)TCL_SIZE_MAX) {
+            ckfree((char*)pooled);
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("batch result exceeds the maximum Tcl value size (needs Tcl 9 for > 2 GB)", -1));
+            return TCL_ERROR;
+        }
+        Tcl_Obj *slab = Tcl_NewByteArrayObj(NULL, 0);
+        float *out = (float *) Tcl_SetByteArrayLength(slab, (Tcl_Size)(values * sizeof(float)));
+        for (size_t i = 0; i < values; i++) out[i] = (float)pooled[i];
+        Tcl_SetObjResult(interp, slab);
+    } else {
+        Tcl_Obj *rows = Tcl_NewListObj(0, NULL);
+        for (Tcl_Size r = 0; r < count; r++) {
+            Tcl_Obj *row = Tcl_NewListObj(0, NULL);
+            for (int i = 0; i < dim; i++) {
+                Tcl_ListObjAppendElement(NULL, row, Tcl_NewDoubleObj(pooled[(size_t)r * dim + i]));
+            }
+            Tcl_ListObjAppendElement(NULL, rows, row);
+        }
+        Tcl_SetObjResult(interp, rows);
+    }
+    TCLEMB_PROBE1(marshal__end, dim);
+    StageTimer_Mark(&timer, STAGE_MARSHAL);
+    StageTimer_Total(&timer);
+
+    ckfree((char*)pooled);
+    return TCL_OK;
+}
+
+// --- RELOAD ---
+// Carga en segundo plano de un modelo nuevo para un handle
+struct EmbeddingReload {
+    EmbeddingState *state;
+    char *path;
+    size_t bytes;           // Reservado para el modelo nuevo
+    Tcl_ThreadId thread;
+    int done;               // El hilo terminó (atómico)
+    char *error;            // NULL = el modelo nuevo quedó en uso
+};
+
+// Un Run de dos tokens antes de poner la sesión en uso: ORT prepara kernels
+// y arena en el primer Run, y ese costo no le tiene que tocar a una consulta
+static char *Model_Warm(EmbeddingModel *model) {
+    int64_t ids[2] = {101, 102}, types[2] = {0, 0}, positions[2] = {0, 1};
+    int64_t mask[4] = {1, 1, 1, 1};
+    int64_t shape[] = {1, 2}, mask_shape[] = {1, 2, 2};
+    const char *input_names[] = {"input_ids", "attention_mask", "token_type_ids", "position_ids"};
+    const char *output_names[] = {model->hidden_name};
+    OrtValue *inputs[4] = {NULL, NULL, NULL, NULL}, *out = NULL;
+    OrtMemoryInfo *memory_info = NULL;
+    size_t ninputs = model->packable ? 4 : 3;
+
+    OrtStatus *st = g_ort->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &memory_info);
+    if (!st) st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, ids, sizeof(ids), shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &inputs[0]);
+    if (!st) st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, mask, model->packable ? sizeof(mask) : 2 * sizeof(int64_t),
+                                                        model->packable ? mask_shape : shape, model->packable ? 3 : 2,
+                                                        ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &inputs[1]);
+    if (!st) st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, types, sizeof(types), shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &inputs[2]);
+    if (!st && model->packable) st = g_ort->CreateTensorWithDataAsOrtValue(memory_info, positions, sizeof(positions), shape, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &inputs[3]);
+    if (!st) st = g_ort->Run(model->session, NULL, input_names, (const OrtValue *const *)inputs, ninputs, output_names, 1, &out);
+    char *error = st ? StatusString(st) : NULL;
+
+    for (int i = 0; i < 4; i++) if (inputs[i]) g_ort->ReleaseValue(inputs[i]);
+    if (out) g_ort->ReleaseValue(out);
+    if (memory_info) g_ort->ReleaseMemoryInfo(memory_info);
+    return error;
+}
+
+static Tcl_ThreadCreateType ReloadThread(ClientData cd) {
+    EmbeddingReload *job = (EmbeddingReload *) cd;
+    EmbeddingState *state = job->state;
+    EmbeddingModel *model = NULL;
+
+    // Sin el contenedor compartido: sus entradas viven hasta que se libera el
+    // último handle, y cada versión desplegada dejaría sus pesos ahí
+    job->error = Model_Load(state, job->path, job->bytes, 0, &model);
+    if (!job->error) job->error = Model_Warm(model);
+    if (job->error) {
+        if (model) Model_Release(state, model);
+    } else {
+        // Los Run que ya tomaron el modelo viejo terminan con él; el último lo libera
+        Tcl_MutexLock(&state->model_mutex);
+        EmbeddingModel *old = state->model;
+        state->model = model;
+        state->generation++;
+        Tcl_MutexUnlock(&state->model_mutex);
+        Model_Release(state, old);
+    }
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+// Espera al hilo de carga y guarda su resultado en el estado
+static void Reload_Finish(EmbeddingState *state) {
+    EmbeddingReload *job = state->reload;
+    int code;
+    Tcl_JoinThread(job->thread, &code);
+    if (state->reload_error) ckfree(state->reload_error);
+    state->reload_error = job->error;
+    ckfree(job->path);
+    ckfree((char *)job);
+    state->reload = NULL;
+}
+
+static int ReloadStatus(Tcl_Interp *interp, EmbeddingState *state) {
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    const char *status = state->reload ? "loading" : (state->reload_error ? "failed" : "idle");
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("status", -1), Tcl_NewStringObj(status, -1));
+    Tcl_MutexLock(&state->model_mutex);
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("model", -1), Tcl_NewStringObj(state->model->path, -1));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("layers", -1), Tcl_NewIntObj(state->model->layers));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("generation", -1), Tcl_NewWideIntObj((Tcl_WideInt)state->generation));
+    Tcl_MutexUnlock(&state->model_mutex);
+    if (state->reload) {
+        Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("loading", -1), Tcl_NewStringObj(state->reload->path, -1));
+    } else if (state->reload_error) {
+        Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("error", -1), Tcl_NewStringObj(state->reload_error, -1));
+    }
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+// embedding::reload handle ?model_path? ?-wait bool?
+// Con model_path, un hilo arma y calienta una sesión nueva con las opciones
+// del handle (-mmap, -threads) y la pone en uso; mientras tanto el handle
+// sigue respondiendo con el modelo anterior. Vuelve enseguida, salvo con
+// -wait 1, que espera y devuelve el error de la carga si lo hubo.
+// Sin model_path devuelve el estado: status (idle, loading o failed), model,
+// generation y, según el caso, loading o error.
+static int TclEmbedding_Reload_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    static const char *const options[] = {"-wait", NULL};
+
+    if (objc != 2 && objc != 3 && objc != 5) {
+        Tcl_WrongNumArgs(interp, 1, objv, "handle ?model_path? ?-wait bool?");
+        return TCL_ERROR;
+    }
+
+    EmbeddingState *state;
+    if (GetEmbeddingState(interp, objv[1], &state) != TCL_OK) return TCL_ERROR;
+
+    int wait = 0;
+    if (objc == 5) {
+        int idx;
+        if (Tcl_GetIndexFromObj(interp, objv[3], options, "option", 0, &idx) != TCL_OK) return TCL_ERROR;
+        if (Tcl_GetBooleanFromObj(interp, objv[4], &wait) != TCL_OK) return TCL_ERROR;
+    }
+
+    // Una carga ya terminada se cierra antes de informar o de empezar otra
+    if (state->reload && __atomic_load_n(&state->reload->done, __ATOMIC_ACQUIRE)) Reload_Finish(state);
+    if (objc == 2) return ReloadStatus(interp, state);
+
+    if (state->reload) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("reload of \"%s\" already in progress", state->reload->path));
+        return TCL_ERROR;
+    }
+
+    // Los dos modelos conviven hasta que termina el último Run del viejo
+    const char *path = Tcl_GetString(objv[2]);
+    struct stat sb;
+    if (stat(path, &sb) != 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("cannot stat model \"%s\": %s", path, Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+    if (Memory_ReserveOrError(interp, &state->mem, (size_t)sb.st_size) != TCL_OK) return TCL_ERROR;
+
+    EmbeddingReload *job = (EmbeddingReload *) ckalloc(sizeof(EmbeddingReload));
+    memset(job, 0, sizeof(EmbeddingReload));
+    job->state = state;
+    job->bytes = (size_t)sb.st_size;
+    job->path = ckalloc(strlen(path) + 1);
+    strcpy(job->path, path);
+    if (Tcl_CreateThread(&job->thread, ReloadThread, job, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+        Memory_Release(&state->mem, job->bytes);
+        ckfree(job->path);
+        ckfree((char *)job);
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("cannot start reload thread", -1));
+        return TCL_ERROR;
+    }
+    state->reload = job;
+
+    if (wait) {
+        Reload_Finish(state);
+        if (state->reload_error) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(state->reload_error, -1));
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
 }
 
 static int TclEmbedding_Free_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]) {
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "handle");
+        return TCL_ERROR;
+    }
+
+    // Borrar el comando del handle dispara EmbeddingState_Delete
+    EmbeddingState *state;
+    if (GetEmbeddingState(interp, objv[1], &state) != TCL_OK) return TCL_ERROR;
+    Tcl_DeleteCommand(interp, Tcl_GetString(objv[1]));
     return TCL_OK;
 }
 
 int Tclembedding_Init(Tcl_Interp *interp) {
-    if (Tcl_InitStubs(interp, "8.6", 0) == NULL) return TCL_ERROR;
+    if (Tcl_InitStubs(interp, "8.6-", 0) == NULL) return TCL_ERROR;
     Tcl_CreateObjCommand(interp, "embedding::init_raw", TclEmbedding_Init_Cmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "embedding::compute", TclEmbedding_Compute_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::compute_batch", TclEmbedding_ComputeBatch_Cmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "embedding::free", TclEmbedding_Free_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::reload", TclEmbedding_Reload_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::latency", TclEmbedding_Latency_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::memory", TclEmbedding_Memory_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::store", TclEmbedding_Store_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::refine", TclEmbedding_Refine_Cmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "embedding::pca_fit", TclEmbedding_PcaFit_Cmd, NULL, NULL);
     return Tcl_PkgProvide(interp, "tclembedding", "1.0");
 }
 
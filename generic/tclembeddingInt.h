@@ -0,0 +1,299 @@
+/*
+ * tclembeddingInt.h - Declaraciones internas compartidas por los .c de generic/
+ * - Estado de un handle (EmbeddingState)
+ * - Sondas USDT
+ * - Etapas de cómputo e histogramas de latencia
+ * - Contabilidad de memoria
+ * - Almacén de vectores, índice IVF y producto punto SIMD
+ * - Proyección PCA
+ */
+
+#ifndef TCLEMBEDDING_INT_H
+#define TCLEMBEDDING_INT_H
+
+#include <tcl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include "onnxruntime_c_api.h"
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#  include <immintrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tcl 9 usa Tcl_Size (64 bits) para longitudes; en 8.6 es int
+#ifndef TCL_SIZE_MAX
+typedef int Tcl_Size;
+#  define TCL_SIZE_MAX INT_MAX
+#  define TCL_SIZE_MODIFIER ""
+#endif
+
+// Sondas USDT (proveedor "tclembedding") para bpftrace/SystemTap. Cada sonda
+// es un NOP en el binario; sin <sys/sdt.h> o con -DTCLEMBEDDING_NO_PROBES
+// desaparecen del todo.
+#if !defined(TCLEMBEDDING_NO_PROBES) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define TCLEMB_PROBE1(name, a)       DTRACE_PROBE1(tclembedding, name, a)
+#    define TCLEMB_PROBE2(name, a, b)    DTRACE_PROBE2(tclembedding, name, a, b)
+#    define TCLEMB_PROBE3(name, a, b, c) DTRACE_PROBE3(tclembedding, name, a, b, c)
+#  endif
+#endif
+#ifndef TCLEMB_PROBE1
+#  define TCLEMB_PROBE1(name, a)       do { } while (0)
+#  define TCLEMB_PROBE2(name, a, b)    do { } while (0)
+#  define TCLEMB_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+// Etapas de embedding::compute (mismos puntos que las sondas USDT)
+typedef enum {
+    STAGE_TOKENIZE,
+    STAGE_TENSOR,
+    STAGE_RUN,
+    STAGE_POOL,
+    STAGE_MARSHAL,
+    STAGE_TOTAL,
+    STAGE_COUNT
+} EmbeddingStage;
+
+typedef struct LatencyShard LatencyShard;
+
+// Consumidores de memoria contabilizados por embedding::memory
+typedef enum {
+    MEM_MODEL,
+    MEM_VOCAB,
+    MEM_CACHE,
+    MEM_INDEX,
+    MEM_KIND_COUNT
+} MemKind;
+
+typedef struct MemAccount MemAccount;
+
+// Libera hasta `want` bytes de una caché y devuelve cuántos liberó.
+// Corre con el mutex de memoria tomado: no llamar a Memory_* desde aquí.
+typedef size_t (MemEvictProc)(MemAccount *acct, size_t want);
+
+struct MemAccount {
+    MemKind kind;
+    char name[64];
+    size_t bytes;
+    uint64_t last_used;
+    MemEvictProc *evict;    // Solo cachés; NULL si no se puede desalojar
+    void *owner;            // NULL en cuentas creadas desde Tcl
+    MemAccount *prev, *next;
+};
+
+// Proyección PCA aplicada después del pooling (pca.c)
+typedef struct Projection Projection;
+
+// Estructura de estado
+typedef struct EmbeddingModel EmbeddingModel;
+typedef struct EmbeddingReload EmbeddingReload;
+
+typedef struct {
+    EmbeddingModel* model;  // Sesión en uso; embedding::reload la reemplaza (model_mutex)
+    Tcl_Mutex model_mutex;
+    uint64_t generation;    // Modelos puestos en uso por reload
+    EmbeddingReload* reload;    // Carga en segundo plano; NULL = ninguna
+    char* reload_error;     // Error de la última carga fallida
+    OrtSessionOptions* options;
+    OrtEnv* env;
+    int use_mmap;
+    int layers;             // init_raw -layers N, 0 = salida de la última capa
+    int embedding_dim;
+    OrtPrepackedWeightsContainer* prepacked;
+    uint64_t id;            // Único por proceso, nunca se reutiliza
+    Tcl_Mutex latency_mutex;
+    LatencyShard* latency_shards;
+    MemAccount mem;         // Pesos del modelo + pico de activaciones
+    size_t activation_peak;
+    Projection* projection; // init_raw -projection, NULL = salida del modelo tal cual
+} EmbeddingState;
+
+extern const OrtApi* g_ort;
+
+// tclembedding.c
+int GetEmbeddingState(Tcl_Interp *interp, Tcl_Obj *handle, EmbeddingState **statePtr);
+
+// latency.c
+uint64_t Latency_Now(void);
+LatencyShard* Latency_ShardFor(EmbeddingState *state);
+void Latency_Record(LatencyShard *shard, EmbeddingStage stage, uint64_t ns);
+void Latency_Free(EmbeddingState *state);
+int TclEmbedding_Latency_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+
+// Cronómetro por etapa: un timestamp por frontera
+typedef struct {
+    LatencyShard* shard;
+    uint64_t start;
+    uint64_t prev;
+} StageTimer;
+
+static inline void StageTimer_Start(StageTimer *timer, EmbeddingState *state) {
+    timer->shard = Latency_ShardFor(state);
+    timer->start = timer->prev = Latency_Now();
+}
+
+static inline void StageTimer_Mark(StageTimer *timer, EmbeddingStage stage) {
+    uint64_t now = Latency_Now();
+    Latency_Record(timer->shard, stage, now - timer->prev);
+    timer->prev = now;
+}
+
+static inline void StageTimer_Total(StageTimer *timer) {
+    Latency_Record(timer->shard, STAGE_TOTAL, timer->prev - timer->start);
+}
+
+// memory.c
+void Memory_Register(MemAccount *acct, MemKind kind, const char *name, MemEvictProc *evict, void *owner);
+void Memory_Unregister(MemAccount *acct);
+void Memory_Touch(MemAccount *acct);
+int Memory_Reserve(MemAccount *acct, size_t bytes);
+int Memory_ReserveOrError(Tcl_Interp *interp, MemAccount *acct, size_t bytes);
+void Memory_Charge(MemAccount *acct, size_t bytes);
+void Memory_Release(MemAccount *acct, size_t bytes);
+int TclEmbedding_Memory_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+
+// Producto punto float32; el kernel se elige en compilación como en la UDF
+static inline float Vec_Dot(const float *a, const float *b, int n) {
+    int i = 0;
+    float dot = 0.0f;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i <= n - 8; i += 8) acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    dot = _mm_cvtss_f32(s);
+#elif defined(__SSE4_1__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i <= n - 4; i += 4) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_movehdup_ps(acc));
+    dot = _mm_cvtss_f32(acc);
+#else
+    // Ocho acumuladores independientes: el compilador los vectoriza con SSE2
+    float acc[8] = {0};
+    for (; i <= n - 8; i += 8) {
+        for (int j = 0; j < 8; j++) acc[j] += a[i + j] * b[i + j];
+    }
+    dot = ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+#endif
+    for (; i < n; i++) dot += a[i] * b[i];
+    return dot;
+}
+
+// Kernel de producto punto con la misma firma que Vec_Dot; Vec_DotFor
+// (store.c) devuelve el especializado para dim o uno genérico
+typedef float (VecDotProc)(const float *a, const float *b, int n);
+VecDotProc *Vec_DotFor(int dim);
+
+// y += a * x
+static inline void Vec_Axpy(float *y, float a, const float *x, int n) {
+    int i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 va = _mm256_set1_ps(a);
+    for (; i <= n - 8; i += 8) _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+#elif defined(__SSE4_1__)
+    __m128 va = _mm_set1_ps(a);
+    for (; i <= n - 4; i += 4) _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+#endif
+    for (; i < n; i++) y[i] += a * x[i];
+}
+
+// pca.c
+int Projection_Load(Tcl_Interp *interp, const char *path, Projection **projPtr);
+void Projection_Free(Projection *proj);
+int Projection_InDim(const Projection *proj);
+int Projection_OutDim(const Projection *proj);
+size_t Projection_Bytes(const Projection *proj);
+void Projection_Apply(const Projection *proj, const double *in, double *out, Tcl_Size rows);
+int TclEmbedding_PcaFit_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+
+// Lista dinámica de filas (por categoría o por lista IVF), en orden de inserción
+typedef struct {
+    Tcl_Size count;
+    Tcl_Size capacity;
+    Tcl_Size* rows;
+} RowList;
+
+// Planes de búsqueda del almacén
+typedef enum {
+    PLAN_SCAN,              // Barrido completo; el filtro se evalúa por fila
+    PLAN_SUBSET,            // Solo las filas de las categorías del filtro
+    PLAN_IVF,               // Sondeo de las nprobe listas IVF más cercanas
+    PLAN_COUNT
+} PlanKind;
+
+typedef struct {
+    PlanKind kind;
+    double cost[PLAN_COUNT];    // Costo estimado en productos punto; < 0 = no elegible
+    double selectivity;         // Fracción de filas que pasa el filtro
+    int nprobe;
+    Tcl_Size scanned;           // Filas puntuadas de verdad
+    double work;                // Costo real (mismas unidades que cost)
+    double target_ns;           // -target_latency_ms; 0 = sin objetivo
+    double predicted_ns;        // Latencia prevista por el modelo; 0 = sin modelo
+    uint64_t elapsed_ns;
+} StorePlan;
+
+// Latencia de búsqueda de un plan: ns = a + b * costo, por mínimos
+// cuadrados con olvido exponencial sobre las búsquedas recientes
+typedef struct {
+    double w, sx, sy, sxx, sxy;     // Sumas ponderadas
+    Tcl_WideInt samples;
+} SearchLatencyModel;
+
+// Filas por bloque en -layout blocked: dos registros AVX de 8 floats
+#define STORE_BLOCK 16
+
+// Almacén de vectores en proceso (store.c). Filas normalizadas a norma 1.
+typedef struct {
+    int dim;
+    VecDotProc* dot;        // Vec_DotFor(dim), elegido al crear el almacén
+    int blocked;            // -layout blocked: ver Store_Row
+    Tcl_Size count;
+    Tcl_Size capacity;
+    float* vectors;         // count x dim; blocked: bloques de STORE_BLOCK filas, dim x STORE_BLOCK
+    Tcl_WideInt* ids;
+    float* attrs;           // Atributo por fila para el decaimiento (p. ej. edad en días)
+    int* categories;        // Índice en category_names, -1 = sin categoría
+    Tcl_HashTable category_index;   // nombre -> índice
+    Tcl_Obj* category_names;
+    RowList* category_rows; // Filas por categoría; sus conteos guían al planificador
+    int category_capacity;
+    int nlist;              // Índice IVF (ivf.c); 0 = sin índice
+    int nprobe;             // Sondeo por omisión
+    float* centroids;       // nlist x dim, normalizados
+    RowList* lists;
+    StorePlan last_plan;
+    Tcl_WideInt plan_counts[PLAN_COUNT];
+    SearchLatencyModel latency_models[PLAN_COUNT];
+    MemAccount mem;
+} VectorStore;
+
+// store.c
+int GetVectorStore(Tcl_Interp *interp, Tcl_Obj *handle, VectorStore **storePtr);
+int TclEmbedding_Store_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+void RowList_Push(RowList *list, Tcl_Size row);
+const float *Store_Row(const VectorStore *store, Tcl_Size row, float *scratch);
+void Vec_Rocchio(float *query, int dim, float alpha,
+                 float beta, const float *const *pos, int npos,
+                 float gamma, const float *const *neg, int nneg);
+int TclEmbedding_Refine_Cmd(ClientData cd, Tcl_Interp *interp, int objc, Tcl_Obj *const objv[]);
+
+// ivf.c
+int Ivf_Build(Tcl_Interp *interp, VectorStore *store, int nlist, int iterations, Tcl_Size sample);
+void Ivf_Free(VectorStore *store);
+int Ivf_Nearest(const VectorStore *store, const float *vec);
+int Ivf_Probe(const VectorStore *store, const float *query, int nprobe, int *lists);
+void Ivf_Order(const VectorStore *store, Tcl_Size *order);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TCLEMBEDDING_INT_H */
@@ -0,0 +1,207 @@
+package provide tclembedding::autotune 1.0.0
+
+# Autoajuste en línea de batch size e intra-op threads para la ingesta.
+#
+# El llamador procesa lotes con la configuración de [autotune::current] y
+# reporta cada uno con [autotune::record]. El tuner mide tokens reales por
+# segundo (no depende de la mezcla de largos como docs/s) en ventanas,
+# sube la colina probando vecinos (batch x2 / /2, threads +/- un paso) y
+# se asienta cuando ningún vecino mejora. Asentado, sigue midiendo: si el
+# largo medio de los textos o el throughput se mueven más de -drift,
+# vuelve a explorar desde la configuración actual.
+#
+#   set t [autotune::new -threads {1 2 4}]
+#   set cfg [autotune::current $t]       ;# -> batch 16 threads 1
+#   ...
+#   if {[autotune::record $t $docs $tokens $secs]} { ...aplicar current... }
+
+namespace eval autotune {
+    variable next_id 0
+
+    proc new {args} {
+        variable next_id
+        set cpus 1
+        catch {set cpus [exec getconf _NPROCESSORS_ONLN]}
+        set threads [list]
+        for {set n 1} {$n <= $cpus} {set n [expr {$n * 2}]} { lappend threads $n }
+        if {[lindex $threads end] != $cpus} { lappend threads $cpus }
+
+        set opts [dict create \
+            -batch_sizes {1 2 4 8 16 32 64 128} \
+            -threads     $threads \
+            -batch       16 \
+            -thread      1 \
+            -window_docs 200 \
+            -window_secs 2.0 \
+            -min_gain    0.03 \
+            -drift       0.25 \
+            -log         {puts} \
+        ]
+        foreach {key value} $args {
+            if {![dict exists $opts $key]} {
+                error "bad option \"$key\": must be [join [dict keys $opts] {, }]"
+            }
+            dict set opts $key $value
+        }
+
+        set token [namespace current]::tuner[incr next_id]
+        upvar #0 $token t
+        set t(opts) $opts
+        set t(batches) [lsort -integer -unique [dict get $opts -batch_sizes]]
+        set t(threads) [lsort -integer -unique [dict get $opts -threads]]
+        set t(center) [list [Nearest $t(batches) [dict get $opts -batch]] \
+                            [Nearest $t(threads) [dict get $opts -thread]]]
+        set t(state) exploring
+        set t(measured) [dict create]
+        set t(pending) [list]
+        set t(trial) $t(center)
+        set t(reference) {}
+        ResetWindow $token
+        return $token
+    }
+
+    proc current {token} {
+        upvar #0 $token t
+        lassign $t(trial) batch threads
+        return [dict create batch $batch threads $threads]
+    }
+
+    # Mejor configuración conocida y su throughput
+    proc best {token} {
+        upvar #0 $token t
+        lassign $t(center) batch threads
+        set result [dict create batch $batch threads $threads state $t(state)]
+        if {[dict exists $t(measured) $t(center)]} {
+            set result [dict merge $result [dict get $t(measured) $t(center)]]
+        }
+        return $result
+    }
+
+    proc destroy {token} {
+        upvar #0 $token t
+        unset t
+    }
+
+    # Reporta un lote. Devuelve 1 si la configuración a usar cambió.
+    proc record {token docs tokens seconds} {
+        upvar #0 $token t
+        incr t(w_docs) $docs
+        incr t(w_tokens) $tokens
+        set t(w_secs) [expr {$t(w_secs) + $seconds}]
+        if {$t(w_docs) < [dict get $t(opts) -window_docs] ||
+            $t(w_secs) < [dict get $t(opts) -window_secs]} {
+            return 0
+        }
+
+        set secs [expr {max($t(w_secs), 1e-9)}]
+        set sample [dict create \
+            docs_per_sec   [expr {$t(w_docs) / $secs}] \
+            tokens_per_sec [expr {$t(w_tokens) / $secs}] \
+            tokens_per_doc [expr {double($t(w_tokens)) / max($t(w_docs), 1)}] \
+        ]
+        ResetWindow $token
+
+        if {$t(state) eq "settled"} {
+            return [CheckDrift $token $sample]
+        }
+        dict set t(measured) $t(trial) $sample
+        return [Advance $token]
+    }
+
+    # --- internos ---
+
+    proc ResetWindow {token} {
+        upvar #0 $token t
+        set t(w_docs) 0
+        set t(w_tokens) 0
+        set t(w_secs) 0.0
+    }
+
+    proc Nearest {values target} {
+        set best [lindex $values 0]
+        foreach v $values {
+            if {abs($v - $target) < abs($best - $target)} { set best $v }
+        }
+        return $best
+    }
+
+    proc Neighbors {token config} {
+        upvar #0 $token t
+        lassign $config batch threads
+        set bi [lsearch -exact $t(batches) $batch]
+        set ti [lsearch -exact $t(threads) $threads]
+        set result [list]
+        foreach {db dt} {1 0 -1 0 0 1 0 -1} {
+            set nb [lindex $t(batches) [expr {$bi + $db}]]
+            set nt [lindex $t(threads) [expr {$ti + $dt}]]
+            if {$nb ne "" && $nt ne "" && $bi + $db >= 0 && $ti + $dt >= 0} {
+                lappend result [list $nb $nt]
+            }
+        }
+        return $result
+    }
+
+    proc Rate {token config} {
+        upvar #0 $token t
+        return [dict get $t(measured) $config tokens_per_sec]
+    }
+
+    # Siguiente paso de la búsqueda: medir el próximo vecino pendiente o,
+    # con todos medidos, moverse al mejor si gana más de -min_gain
+    proc Advance {token} {
+        upvar #0 $token t
+        set previous $t(trial)
+
+        if {[llength $t(pending)] == 0} {
+            foreach n [Neighbors $token $t(center)] {
+                if {![dict exists $t(measured) $n]} { lappend t(pending) $n }
+            }
+            if {[llength $t(pending)] == 0} {
+                set best $t(center)
+                foreach n [Neighbors $token $t(center)] {
+                    if {[Rate $token $n] > [Rate $token $best]} { set best $n }
+                }
+                set gain [expr {1.0 + [dict get $t(opts) -min_gain]}]
+                if {$best ne $t(center) && [Rate $token $best] > [Rate $token $t(center)] * $gain} {
+                    set t(center) $best
+                    return [Advance $token]
+                }
+                set t(state) settled
+                set t(trial) $t(center)
+                set t(reference) [dict get $t(measured) $t(center)]
+                Log $token "settled on"
+                return [expr {$t(trial) ne $previous}]
+            }
+        }
+        set t(pending) [lassign $t(pending) t(trial)]
+        return [expr {$t(trial) ne $previous}]
+    }
+
+    proc CheckDrift {token sample} {
+        upvar #0 $token t
+        set drift [dict get $t(opts) -drift]
+        set ref_len [dict get $t(reference) tokens_per_doc]
+        set ref_rate [dict get $t(reference) tokens_per_sec]
+        set len_change [expr {abs([dict get $sample tokens_per_doc] - $ref_len) / max($ref_len, 1e-9)}]
+        set rate_drop [expr {($ref_rate - [dict get $sample tokens_per_sec]) / max($ref_rate, 1e-9)}]
+        if {$len_change <= $drift && $rate_drop <= $drift} {
+            return 0
+        }
+
+        # La carga cambió: las mediciones viejas ya no comparan
+        set t(state) exploring
+        set t(measured) [dict create $t(center) $sample]
+        set t(pending) [list]
+        Log $token [format "input shifted (%.0f -> %.0f tokens/doc), re-tuning from" \
+            $ref_len [dict get $sample tokens_per_doc]]
+        return [Advance $token]
+    }
+
+    proc Log {token what} {
+        upvar #0 $token t
+        lassign $t(center) batch threads
+        set m [dict get $t(measured) $t(center)]
+        {*}[dict get $t(opts) -log] [format "autotune: %s batch %d threads %d (%.1f docs/s, %.0f tokens/s)" \
+            $what $batch $threads [dict get $m docs_per_sec] [dict get $m tokens_per_sec]]
+    }
+}
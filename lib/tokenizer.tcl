@@ -34,7 +34,11 @@ namespace eval tokenizer {
         # Caso A: Lista de Listas (SentencePiece / Xenova) -> [["<s>", 0.0], ["pad", 0.0]]
         # Caso B: Diccionario plano (BERT) -> {"<s>": 0, "pad": 1}
         
-        set vocab [dict create]
+        # Se arma aparte: el vocabulario actual sigue en uso si algo falla
+        set new_vocab [dict create]
+        set new_unk $unk_id
+        set new_bos $bos_id
+        set new_eos $eos_id
         set first_item [lindex $raw_vocab 0]
         
         if {[llength $first_item] > 1} {
@@ -43,26 +47,97 @@ namespace eval tokenizer {
             foreach item $raw_vocab {
                 # El token es el primer elemento de la sublista
                 set token [lindex $item 0]
-                dict set vocab $token $idx
+                dict set new_vocab $token $idx
                 
                 # Detectar IDs especiales al vuelo
-                if {$token eq "<unk>"} { set unk_id $idx }
-                if {$token eq "<s>"}   { set bos_id $idx }
-                if {$token eq "</s>"}  { set eos_id $idx }
+                if {$token eq "<unk>"} { set new_unk $idx }
+                if {$token eq "<s>"}   { set new_bos $idx }
+                if {$token eq "</s>"}  { set new_eos $idx }
                 
                 incr idx
             }
         } else {
             puts "   Detected Format: Flat Dictionary (Key = Token, Val = ID)"
-            set vocab $raw_vocab
+            set new_vocab $raw_vocab
             # Intentar buscar unk explícito si es dict
-            if {[dict exists $vocab "<unk>"]} { set unk_id [dict get $vocab "<unk>"] }
+            if {[dict exists $new_vocab "<unk>"]} { set new_unk [dict get $new_vocab "<unk>"] }
         }
         
+        # Reportar el tamaño a embedding::memory antes de reemplazar: si
+        # excede el presupuesto, el error deja todo como estaba. Los
+        # vocabularios guardados tienen su propia cuenta (ver save_vocab).
+        track tokenizer [vocab_bytes $new_vocab]
+        set vocab $new_vocab
+        set unk_id $new_unk
+        set bos_id $new_bos
+        set eos_id $new_eos
+
         puts "✅ Vocabulario cargado: [dict size $vocab] tokens."
         puts "   Special Tokens -> BOS: $bos_id | EOS: $eos_id | UNK: $unk_id"
     }
 
+    # Vocabularios con nombre, para tokenizar con dos modelos en el mismo
+    # proceso (p. ej. durante una migración). Cambiar de vocabulario solo
+    # intercambia referencias: no copia el dict.
+    #
+    # Cuentas en embedding::memory: "tokenizer" es el vocabulario cargado
+    # sin guardar, "tokenizer:<name>" cada guardado. Así dos vocabularios
+    # residentes suman en vez de pisarse.
+    variable saved
+    array set saved {}
+
+    # embedding::memory track, si la extensión está cargada
+    proc track {name bytes} {
+        if {[llength [info commands ::embedding::memory]]} {
+            embedding::memory track vocab $name $bytes
+        }
+    }
+
+    proc save_vocab {name} {
+        variable vocab
+        variable unk_id
+        variable bos_id
+        variable eos_id
+        variable saved
+        # El cargo pasa de "tokenizer" a "tokenizer:$name"; si el nombre ya
+        # tenía otro vocabulario, ese se libera
+        set bytes [vocab_bytes]
+        track tokenizer 0
+        if {[catch {track tokenizer:$name $bytes} err opts]} {
+            track tokenizer $bytes
+            return -options $opts $err
+        }
+        set saved($name) [list $vocab $unk_id $bos_id $eos_id]
+    }
+
+    proc use_vocab {name} {
+        variable vocab
+        variable unk_id
+        variable bos_id
+        variable eos_id
+        variable saved
+        if {![info exists saved($name)]} {
+            error "vocabulario '$name' no guardado (usar tokenizer::save_vocab)"
+        }
+        lassign $saved($name) vocab unk_id bos_id eos_id
+        # El vocabulario sin guardar, si había, ya no está residente
+        track tokenizer 0
+    }
+
+    # Estimación de bytes del dict: cadena del token + Tcl_Obj + entrada de hash.
+    # Sin argumento, la del vocabulario en uso.
+    proc vocab_bytes {{words ""}} {
+        variable vocab
+        if {$words eq ""} {
+            set words $vocab
+        }
+        set bytes 0
+        dict for {token id} $words {
+            incr bytes [expr {[string length $token] + 96}]
+        }
+        return $bytes
+    }
+
     proc tokenize {text} {
         variable vocab
         variable unk_id
@@ -0,0 +1,1140 @@
+/*
+ * vector_index.c - MySQL daemon plugin: in-memory IVF index for vector_knn()
+ *
+ * cosine_similarity() scans every row: MySQL cannot use an index for it.
+ * This plugin keeps an IVF index (spherical k-means, as embedding::store
+ * index) of the embedding column of one or more tables inside mysqld:
+ *
+ * - On startup a background thread reads each configured table through the
+ *   session service (SELECT id, embedding) and trains the index; the server
+ *   accepts connections meanwhile
+ * - vector_index_insert() / vector_index_delete(), called from triggers,
+ *   keep it in sync with writes
+ * - vector_knn('table', query, k) returns the top-k ids as a JSON array,
+ *   to be expanded with JSON_TABLE in WHERE id IN (...) and re-scored
+ *   exactly with cosine_similarity()
+ *
+ * Reloads (vector_index_reload()) build a new index aside and swap it in,
+ * so searches keep running on the old one. Writes made while a load runs
+ * go to the live index and to a log replayed on the new one before the
+ * swap. The index is not transactional: a rolled-back insert stays in it
+ * until the next reload.
+ *
+ * COMPILATION (needs the server headers: mysql/plugin.h and the session
+ * services, from the MySQL source tree of the running server version):
+ * gcc -O3 -march=native -ffast-math -fno-math-errno -shared -fPIC \
+ *     -I<mysql-source>/include -o vector_index.so vector_index.c -lpthread -lm
+ * (or: cd unix && make plugin MYSQL_CFLAGS=-I<mysql-source>/include)
+ *
+ * INSTALLATION (my.cnf, then restart or INSTALL PLUGIN):
+ * [mysqld]
+ * plugin-load-add = vector_index.so
+ * vector_index_tables = rag.youtube_rag
+ *
+ * MYSQL REGISTRATION:
+ * CREATE FUNCTION vector_knn RETURNS STRING SONAME 'vector_index.so';
+ * CREATE FUNCTION vector_index_insert RETURNS INTEGER SONAME 'vector_index.so';
+ * CREATE FUNCTION vector_index_delete RETURNS INTEGER SONAME 'vector_index.so';
+ * CREATE FUNCTION vector_index_reload RETURNS INTEGER SONAME 'vector_index.so';
+ * (tools/vector_index.sql has these plus the triggers)
+ *
+ * USAGE:
+ * SELECT id, cosine_similarity(embedding, @q) AS score FROM youtube_rag
+ * WHERE id IN (SELECT k.id FROM JSON_TABLE(vector_knn('youtube_rag', @q, 50),
+ *              '$[*]' COLUMNS (id BIGINT PATH '$')) AS k)
+ * ORDER BY score DESC LIMIT 5;
+ *
+ * Copyright (c) 2024
+ * License: MIT
+ */
+
+/* Services are reached through the server's function tables */
+#ifndef MYSQL_DYNAMIC_PLUGIN
+#define MYSQL_DYNAMIC_PLUGIN
+#endif
+
+#include <mysql.h>
+#include <mysql/plugin.h>
+#include <mysql/service_command.h>
+#include <mysql/service_srv_session.h>
+#include <mysql/service_srv_session_info.h>
+#include <mysql/service_security_context.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <float.h>
+#include <immintrin.h>
+
+/* MySQL 8.0 compatibility - my_bool was removed */
+#ifndef my_bool
+typedef char my_bool;
+#endif
+
+#define VI_MAX_TABLES   16
+#define VI_NAME_LEN     192
+#define VI_MAX_K        10000
+#define VI_KMEANS_ITERS 10
+#define VI_SAMPLE_PER_LIST 64
+
+/* =========================
+   Dot product
+   ========================= */
+
+static inline float vi_dot(const float *a, const float *b, int n) {
+    int i = 0;
+    float dot = 0.0f;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i <= n - 8; i += 8)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    dot = _mm_cvtss_f32(s);
+#elif defined(__SSE4_1__)
+    __m128 acc = _mm_setzero_ps();
+    for (; i <= n - 4; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_movehdup_ps(acc));
+    dot = _mm_cvtss_f32(acc);
+#endif
+    for (; i < n; i++) dot += a[i] * b[i];
+    return dot;
+}
+
+/* Copies src normalized to unit length; 0 for a zero vector */
+static int vi_normalize(float *dst, const float *src, int n) {
+    float norm = sqrtf(vi_dot(src, src, n));
+    if (!(norm > FLT_MIN))
+        return 0;
+    float scale = 1.0f / norm;
+    for (int i = 0; i < n; i++) dst[i] = src[i] * scale;
+    return 1;
+}
+
+/* =========================
+   Vector set: rows, id map and IVF lists
+   ========================= */
+
+typedef struct {
+    int *slots;
+    int count;
+    int capacity;
+} vi_list;
+
+typedef struct {
+    int dim;
+    int count;
+    int capacity;
+    float *vectors;        /* count x dim, unit length */
+    long long *ids;
+    int *list_of;          /* IVF list of each slot, -1 without index */
+    int *pos_in_list;
+    /* id -> slot + 1, open addressing with linear probing (0 = empty) */
+    long long *map_keys;
+    int *map_vals;
+    size_t map_mask;
+    /* IVF */
+    int nlist;
+    float *centroids;
+    vi_list *lists;
+} vi_set;
+
+static inline size_t vi_hash(long long id) {
+    uint64_t x = (uint64_t)id + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return (size_t)(x ^ (x >> 31));
+}
+
+static int vi_map_find(const vi_set *s, long long id) {
+    if (!s->map_vals) return -1;
+    for (size_t i = vi_hash(id) & s->map_mask; s->map_vals[i]; i = (i + 1) & s->map_mask)
+        if (s->map_keys[i] == id) return s->map_vals[i] - 1;
+    return -1;
+}
+
+static void vi_map_put(vi_set *s, long long id, int slot) {
+    size_t i = vi_hash(id) & s->map_mask;
+    while (s->map_vals[i] && s->map_keys[i] != id) i = (i + 1) & s->map_mask;
+    s->map_keys[i] = id;
+    s->map_vals[i] = slot + 1;
+}
+
+/* Backward-shift deletion: no tombstones, probes stay short */
+static void vi_map_remove(vi_set *s, long long id) {
+    size_t i = vi_hash(id) & s->map_mask;
+    while (s->map_vals[i] && s->map_keys[i] != id) i = (i + 1) & s->map_mask;
+    if (!s->map_vals[i]) return;
+    size_t j = i;
+    for (;;) {
+        s->map_vals[i] = 0;
+        for (;;) {
+            j = (j + 1) & s->map_mask;
+            if (!s->map_vals[j]) return;
+            size_t home = vi_hash(s->map_keys[j]) & s->map_mask;
+            /* j's entry may move to i if home is not cyclically in (i, j] */
+            if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) break;
+        }
+        s->map_keys[i] = s->map_keys[j];
+        s->map_vals[i] = s->map_vals[j];
+        i = j;
+    }
+}
+
+static int vi_grow(vi_set *s) {
+    int cap = s->capacity ? s->capacity * 2 : 1024;
+    float *vectors = (float *)realloc(s->vectors, sizeof(float) * (size_t)cap * s->dim);
+    if (!vectors) return 0;
+    s->vectors = vectors;
+    long long *ids = (long long *)realloc(s->ids, sizeof(long long) * cap);
+    if (!ids) return 0;
+    s->ids = ids;
+    int *list_of = (int *)realloc(s->list_of, sizeof(int) * cap);
+    if (!list_of) return 0;
+    s->list_of = list_of;
+    int *pos = (int *)realloc(s->pos_in_list, sizeof(int) * cap);
+    if (!pos) return 0;
+    s->pos_in_list = pos;
+
+    /* Map at <= 50% load */
+    size_t slots = 1;
+    while (slots < (size_t)cap * 2) slots <<= 1;
+    long long *keys = (long long *)calloc(slots, sizeof(long long));
+    int *vals = (int *)calloc(slots, sizeof(int));
+    if (!keys || !vals) {
+        free(keys);
+        free(vals);
+        return 0;
+    }
+    free(s->map_keys);
+    free(s->map_vals);
+    s->map_keys = keys;
+    s->map_vals = vals;
+    s->map_mask = slots - 1;
+    for (int r = 0; r < s->count; r++) vi_map_put(s, s->ids[r], r);
+    s->capacity = cap;
+    return 1;
+}
+
+static int vi_nearest_list(const vi_set *s, const float *vec) {
+    int best = 0;
+    float best_score = -INFINITY;
+    for (int c = 0; c < s->nlist; c++) {
+        float score = vi_dot(vec, s->centroids + (size_t)c * s->dim, s->dim);
+        if (score > best_score) {
+            best_score = score;
+            best = c;
+        }
+    }
+    return best;
+}
+
+static int vi_list_add(vi_set *s, int list, int slot) {
+    vi_list *l = &s->lists[list];
+    if (l->count == l->capacity) {
+        int cap = l->capacity ? l->capacity * 2 : 16;
+        int *slots = (int *)realloc(l->slots, sizeof(int) * cap);
+        if (!slots) return 0;
+        l->slots = slots;
+        l->capacity = cap;
+    }
+    s->list_of[slot] = list;
+    s->pos_in_list[slot] = l->count;
+    l->slots[l->count++] = slot;
+    return 1;
+}
+
+static void vi_list_remove(vi_set *s, int slot) {
+    int list = s->list_of[slot];
+    if (list < 0) return;
+    vi_list *l = &s->lists[list];
+    int pos = s->pos_in_list[slot];
+    int moved = l->slots[--l->count];
+    l->slots[pos] = moved;
+    s->pos_in_list[moved] = pos;
+    s->list_of[slot] = -1;
+}
+
+static void vi_set_free(vi_set *s) {
+    if (!s) return;
+    for (int c = 0; c < s->nlist; c++) free(s->lists[c].slots);
+    free(s->lists);
+    free(s->centroids);
+    free(s->vectors);
+    free(s->ids);
+    free(s->list_of);
+    free(s->pos_in_list);
+    free(s->map_keys);
+    free(s->map_vals);
+    free(s);
+}
+
+/* Insert or replace; 0 on dimension mismatch, zero vector or no memory */
+static int vi_set_upsert(vi_set *s, long long id, const float *vec, int dim) {
+    if (s->dim == 0) s->dim = dim;
+    if (dim != s->dim) return 0;
+
+    int slot = vi_map_find(s, id);
+    if (slot < 0) {
+        if (s->count == s->capacity && !vi_grow(s)) return 0;
+        slot = s->count;
+    }
+    if (!vi_normalize(s->vectors + (size_t)slot * dim, vec, dim)) return 0;
+
+    if (slot == s->count) {
+        s->ids[slot] = id;
+        s->list_of[slot] = -1;
+        vi_map_put(s, id, slot);
+        s->count++;
+    } else {
+        vi_list_remove(s, slot);
+    }
+    if (s->nlist > 0 && !vi_list_add(s, vi_nearest_list(s, s->vectors + (size_t)slot * dim), slot))
+        return 0;
+    return 1;
+}
+
+/* The last row moves into the freed slot */
+static int vi_set_delete(vi_set *s, long long id) {
+    int slot = vi_map_find(s, id);
+    if (slot < 0) return 0;
+    vi_list_remove(s, slot);
+    vi_map_remove(s, id);
+
+    int last = --s->count;
+    if (slot != last) {
+        memcpy(s->vectors + (size_t)slot * s->dim, s->vectors + (size_t)last * s->dim, sizeof(float) * s->dim);
+        s->ids[slot] = s->ids[last];
+        s->list_of[slot] = s->list_of[last];
+        s->pos_in_list[slot] = s->pos_in_list[last];
+        if (s->list_of[slot] >= 0) s->lists[s->list_of[slot]].slots[s->pos_in_list[slot]] = slot;
+        vi_map_put(s, s->ids[slot], slot);
+    }
+    return 1;
+}
+
+static uint64_t vi_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/*
+ * Spherical k-means over a sample, then every row to its nearest list.
+ * nlist 0 = sqrt(rows). Small sets stay flat (exact scan).
+ */
+static int vi_set_train(vi_set *s, int nlist) {
+    if (nlist <= 0) nlist = (int)sqrt((double)s->count);
+    if (nlist > s->count / 8) nlist = s->count / 8;
+    if (nlist < 2) return 1;
+
+    int dim = s->dim;
+    int sample = nlist * VI_SAMPLE_PER_LIST;
+    if (sample > s->count) sample = s->count;
+
+    int *rows = (int *)malloc(sizeof(int) * s->count);
+    float *centroids = (float *)malloc(sizeof(float) * (size_t)nlist * dim);
+    float *sums = (float *)malloc(sizeof(float) * (size_t)nlist * dim);
+    int *sizes = (int *)malloc(sizeof(int) * nlist);
+    vi_list *lists = (vi_list *)calloc(nlist, sizeof(vi_list));
+    if (!rows || !centroids || !sums || !sizes || !lists) {
+        free(rows); free(centroids); free(sums); free(sizes); free(lists);
+        return 0;
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (int r = 0; r < s->count; r++) rows[r] = r;
+    for (int i = 0; i < sample; i++) {
+        int j = i + (int)(vi_random(&seed) % (uint64_t)(s->count - i));
+        int t = rows[i]; rows[i] = rows[j]; rows[j] = t;
+    }
+    for (int c = 0; c < nlist; c++)
+        memcpy(centroids + (size_t)c * dim, s->vectors + (size_t)rows[c] * dim, sizeof(float) * dim);
+
+    vi_set tmp = *s;
+    tmp.nlist = nlist;
+    tmp.centroids = centroids;
+    for (int it = 0; it < VI_KMEANS_ITERS; it++) {
+        memset(sums, 0, sizeof(float) * (size_t)nlist * dim);
+        memset(sizes, 0, sizeof(int) * nlist);
+        for (int i = 0; i < sample; i++) {
+            const float *vec = s->vectors + (size_t)rows[i] * dim;
+            int c = vi_nearest_list(&tmp, vec);
+            float *sum = sums + (size_t)c * dim;
+            for (int d = 0; d < dim; d++) sum[d] += vec[d];
+            sizes[c]++;
+        }
+        for (int c = 0; c < nlist; c++) {
+            float *centroid = centroids + (size_t)c * dim;
+            if (sizes[c] == 0 || !vi_normalize(centroid, sums + (size_t)c * dim, dim)) {
+                int pick = rows[vi_random(&seed) % (uint64_t)sample];
+                memcpy(centroid, s->vectors + (size_t)pick * dim, sizeof(float) * dim);
+            }
+        }
+    }
+    free(rows);
+    free(sums);
+    free(sizes);
+
+    for (int c = 0; c < s->nlist; c++) free(s->lists[c].slots);
+    free(s->lists);
+    free(s->centroids);
+    s->nlist = nlist;
+    s->centroids = centroids;
+    s->lists = lists;
+    for (int r = 0; r < s->count; r++) {
+        s->list_of[r] = -1;
+        if (!vi_list_add(s, vi_nearest_list(s, s->vectors + (size_t)r * dim), r)) return 0;
+    }
+    return 1;
+}
+
+/* =========================
+   Top-k search
+   ========================= */
+
+typedef struct {
+    float score;
+    long long id;
+} vi_hit;
+
+/* Min-heap on score: the root is the weakest of the current top-k */
+static void vi_heap_push(vi_hit *heap, int *n, int k, float score, long long id) {
+    if (*n == k) {
+        if (score <= heap[0].score) return;
+        int i = 0;
+        for (;;) {
+            int l = 2 * i + 1, r = l + 1, m = i;
+            if (l < k && heap[l].score < (m == i ? score : heap[m].score)) m = l;
+            if (r < k && heap[r].score < (m == i ? score : heap[m].score)) m = r;
+            if (m == i) break;
+            heap[i] = heap[m];
+            i = m;
+        }
+        heap[i].score = score;
+        heap[i].id = id;
+        return;
+    }
+    int i = (*n)++;
+    while (i > 0 && heap[(i - 1) / 2].score > score) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i].score = score;
+    heap[i].id = id;
+}
+
+static int vi_hit_desc(const void *a, const void *b) {
+    float x = ((const vi_hit *)a)->score, y = ((const vi_hit *)b)->score;
+    return (x < y) - (x > y);
+}
+
+/* Fills hits (best first) and returns how many; query must be unit length */
+static int vi_set_search(const vi_set *s, const float *query, int k, int nprobe, vi_hit *hits) {
+    int n = 0;
+    if (s->nlist == 0) {
+        for (int r = 0; r < s->count; r++)
+            vi_heap_push(hits, &n, k, vi_dot(query, s->vectors + (size_t)r * s->dim, s->dim), s->ids[r]);
+    } else {
+        if (nprobe <= 0) nprobe = s->nlist >= 16 ? s->nlist / 16 : 1;
+        if (nprobe > s->nlist) nprobe = s->nlist;
+        vi_hit *probe = (vi_hit *)malloc(sizeof(vi_hit) * nprobe);
+        if (!probe) return -1;
+        int np = 0;
+        for (int c = 0; c < s->nlist; c++)
+            vi_heap_push(probe, &np, nprobe, vi_dot(query, s->centroids + (size_t)c * s->dim, s->dim), c);
+        for (int p = 0; p < np; p++) {
+            const vi_list *l = &s->lists[probe[p].id];
+            for (int i = 0; i < l->count; i++) {
+                int r = l->slots[i];
+                vi_heap_push(hits, &n, k, vi_dot(query, s->vectors + (size_t)r * s->dim, s->dim), s->ids[r]);
+            }
+        }
+        free(probe);
+    }
+    qsort(hits, n, sizeof(vi_hit), vi_hit_desc);
+    return n;
+}
+
+/* =========================
+   Indexes and write log
+   ========================= */
+
+typedef struct {
+    long long id;
+    float *vec;            /* NULL = delete */
+    int dim;
+} vi_op;
+
+typedef struct {
+    char name[VI_NAME_LEN];     /* db.table */
+    const char *table;          /* points into name, after the dot */
+    pthread_rwlock_t lock;
+    vi_set *live;               /* serving searches; NULL before the first load */
+    int loading;
+    pthread_t loader;
+    int loader_started;
+    vi_op *log;                 /* writes made while loading */
+    int log_count;
+    int log_capacity;
+    unsigned long long loaded_rows;
+    char error[256];
+} vi_index;
+
+static vi_index *vi_indexes[VI_MAX_TABLES];
+static int vi_index_count;
+static MYSQL_PLUGIN vi_plugin;
+static volatile int vi_shutdown;
+
+/* System variables */
+static char *vi_sys_tables;
+static char *vi_sys_column;
+static char *vi_sys_id_column;
+static char *vi_sys_user;
+static unsigned int vi_sys_nlist;
+static unsigned int vi_sys_nprobe;
+
+/* Status variables (sums over all indexes) */
+static long long vi_stat_rows;
+static long long vi_stat_ready;
+static long long vi_stat_searches;
+static long long vi_stat_inserts;
+static long long vi_stat_deletes;
+
+static void vi_log_free(vi_index *ix) {
+    for (int i = 0; i < ix->log_count; i++) free(ix->log[i].vec);
+    free(ix->log);
+    ix->log = NULL;
+    ix->log_count = ix->log_capacity = 0;
+}
+
+/* Called with the write lock held */
+static void vi_log_append(vi_index *ix, long long id, const float *vec, int dim) {
+    if (ix->log_count == ix->log_capacity) {
+        int cap = ix->log_capacity ? ix->log_capacity * 2 : 256;
+        vi_op *log = (vi_op *)realloc(ix->log, sizeof(vi_op) * cap);
+        if (!log) return;
+        ix->log = log;
+        ix->log_capacity = cap;
+    }
+    vi_op *op = &ix->log[ix->log_count];
+    op->id = id;
+    op->dim = dim;
+    op->vec = NULL;
+    if (vec) {
+        op->vec = (float *)malloc(sizeof(float) * dim);
+        if (!op->vec) return;
+        memcpy(op->vec, vec, sizeof(float) * dim);
+    }
+    ix->log_count++;
+}
+
+/* 'db.table' or just 'table' when unambiguous */
+static vi_index *vi_find(const char *name, unsigned long len) {
+    vi_index *match = NULL;
+    for (int i = 0; i < vi_index_count; i++) {
+        vi_index *ix = vi_indexes[i];
+        if (strlen(ix->name) == len && memcmp(ix->name, name, len) == 0) return ix;
+        if (strlen(ix->table) == len && memcmp(ix->table, name, len) == 0) {
+            if (match) return NULL;
+            match = ix;
+        }
+    }
+    return match;
+}
+
+/* =========================
+   Loader: SELECT id, embedding through the session service
+   ========================= */
+
+typedef struct {
+    vi_index *ix;
+    vi_set *set;
+    int column;
+    long long id;
+    int have_id;
+    const char *blob;
+    size_t blob_len;
+    char error[256];
+} vi_load_ctx;
+
+static int cb_start_result_metadata(void *ctx, uint num_cols, uint flags, const CHARSET_INFO *cs) {
+    (void)ctx; (void)flags; (void)cs;
+    return num_cols == 2 ? 0 : 1;
+}
+static int cb_field_metadata(void *ctx, struct st_send_field *field, const CHARSET_INFO *cs) {
+    (void)ctx; (void)field; (void)cs;
+    return 0;
+}
+static int cb_end_result_metadata(void *ctx, uint server_status, uint warn_count) {
+    (void)ctx; (void)server_status; (void)warn_count;
+    return 0;
+}
+static int cb_start_row(void *ctx) {
+    vi_load_ctx *lc = (vi_load_ctx *)ctx;
+    lc->column = 0;
+    lc->have_id = 0;
+    lc->blob = NULL;
+    return 0;
+}
+static int cb_end_row(void *ctx) {
+    vi_load_ctx *lc = (vi_load_ctx *)ctx;
+    if (vi_shutdown) return 1;
+    if (lc->have_id && lc->blob && lc->blob_len % sizeof(float) == 0 && lc->blob_len > 0) {
+        int dim = (int)(lc->blob_len / sizeof(float));
+        float stack[1024];
+        float *vec = dim <= 1024 ? stack : (float *)malloc(lc->blob_len);
+        if (!vec) return 1;
+        memcpy(vec, lc->blob, lc->blob_len);    /* blob may be unaligned */
+        if (vi_set_upsert(lc->set, lc->id, vec, dim))
+            __atomic_add_fetch(&lc->ix->loaded_rows, 1, __ATOMIC_RELAXED);
+        if (vec != stack) free(vec);
+    }
+    return 0;
+}
+static void cb_abort_row(void *ctx) { (void)ctx; }
+static ulong cb_get_client_capabilities(void *ctx) { (void)ctx; return 0; }
+static int cb_get_null(void *ctx) {
+    ((vi_load_ctx *)ctx)->column++;
+    return 0;
+}
+static int cb_get_integer(void *ctx, longlong value) {
+    vi_load_ctx *lc = (vi_load_ctx *)ctx;
+    if (lc->column++ == 0) {
+        lc->id = value;
+        lc->have_id = 1;
+    }
+    return 0;
+}
+static int cb_get_longlong(void *ctx, longlong value, uint is_unsigned) {
+    (void)is_unsigned;
+    return cb_get_integer(ctx, value);
+}
+static int cb_get_decimal(void *ctx, const decimal_t *value) {
+    (void)value;
+    ((vi_load_ctx *)ctx)->column++;
+    return 0;
+}
+static int cb_get_double(void *ctx, double value, uint32_t decimals) {
+    (void)value; (void)decimals;
+    ((vi_load_ctx *)ctx)->column++;
+    return 0;
+}
+static int cb_get_date(void *ctx, const MYSQL_TIME *value) {
+    (void)value;
+    ((vi_load_ctx *)ctx)->column++;
+    return 0;
+}
+static int cb_get_time(void *ctx, const MYSQL_TIME *value, uint precision) {
+    (void)value; (void)precision;
+    ((vi_load_ctx *)ctx)->column++;
+    return 0;
+}
+static int cb_get_datetime(void *ctx, const MYSQL_TIME *value, uint precision) {
+    (void)value; (void)precision;
+    ((vi_load_ctx *)ctx)->column++;
+    return 0;
+}
+static int cb_get_string(void *ctx, const char *value, size_t length, const CHARSET_INFO *cs) {
+    vi_load_ctx *lc = (vi_load_ctx *)ctx;
+    (void)cs;
+    if (lc->column++ == 0) {
+        /* Text protocol: the id arrives as digits */
+        char digits[32];
+        if (length >= sizeof(digits)) return 0;
+        memcpy(digits, value, length);
+        digits[length] = '\0';
+        lc->id = strtoll(digits, NULL, 10);
+        lc->have_id = 1;
+    } else {
+        lc->blob = value;
+        lc->blob_len = length;
+    }
+    return 0;
+}
+static void cb_handle_ok(void *ctx, uint server_status, uint warn_count, ulonglong affected_rows,
+                         ulonglong last_insert_id, const char *message) {
+    (void)ctx; (void)server_status; (void)warn_count; (void)affected_rows; (void)last_insert_id; (void)message;
+}
+static void cb_handle_error(void *ctx, uint sql_errno, const char *err_msg, const char *sqlstate) {
+    vi_load_ctx *lc = (vi_load_ctx *)ctx;
+    (void)sqlstate;
+    snprintf(lc->error, sizeof(lc->error), "error %u: %s", sql_errno, err_msg);
+}
+static void cb_shutdown(void *ctx, int server_shutdown) {
+    (void)ctx; (void)server_shutdown;
+}
+static bool cb_connection_alive(void *ctx) {
+    (void)ctx;
+    return !vi_shutdown;
+}
+
+static const struct st_command_service_cbs vi_load_cbs = {
+    .start_result_metadata = cb_start_result_metadata,
+    .field_metadata = cb_field_metadata,
+    .end_result_metadata = cb_end_result_metadata,
+    .start_row = cb_start_row,
+    .end_row = cb_end_row,
+    .abort_row = cb_abort_row,
+    .get_client_capabilities = cb_get_client_capabilities,
+    .get_null = cb_get_null,
+    .get_integer = cb_get_integer,
+    .get_longlong = cb_get_longlong,
+    .get_decimal = cb_get_decimal,
+    .get_double = cb_get_double,
+    .get_date = cb_get_date,
+    .get_time = cb_get_time,
+    .get_datetime = cb_get_datetime,
+    .get_string = cb_get_string,
+    .handle_ok = cb_handle_ok,
+    .handle_error = cb_handle_error,
+    .shutdown = cb_shutdown,
+    .connection_alive = cb_connection_alive,
+};
+
+static void vi_session_error(void *ctx, unsigned int sql_errno, const char *err_msg) {
+    vi_load_ctx *lc = (vi_load_ctx *)ctx;
+    snprintf(lc->error, sizeof(lc->error), "session error %u: %s", sql_errno, err_msg);
+}
+
+/* Reads the table into lc->set; 0 on error (message in lc->error) */
+static int vi_load_table(vi_load_ctx *lc) {
+    char db[VI_NAME_LEN];
+    size_t db_len = (size_t)(lc->ix->table - 1 - lc->ix->name);
+    memcpy(db, lc->ix->name, db_len);
+    db[db_len] = '\0';
+
+    MYSQL_SESSION session = srv_session_open(vi_session_error, lc);
+    if (!session) {
+        if (!lc->error[0]) snprintf(lc->error, sizeof(lc->error), "cannot open an internal session");
+        return 0;
+    }
+    MYSQL_SECURITY_CONTEXT sc;
+    if (thd_get_security_context(srv_session_info_get_thd(session), &sc) ||
+        security_context_lookup(sc, vi_sys_user, "localhost", "127.0.0.1", db)) {
+        snprintf(lc->error, sizeof(lc->error), "cannot run as user '%s'@'localhost'", vi_sys_user);
+        srv_session_close(session);
+        return 0;
+    }
+
+    char sql[512];
+    snprintf(sql, sizeof(sql), "SELECT `%s`, `%s` FROM `%s`.`%s` WHERE `%s` IS NOT NULL",
+             vi_sys_id_column, vi_sys_column, db, lc->ix->table, vi_sys_column);
+    COM_DATA cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.com_query.query = sql;
+    cmd.com_query.length = (unsigned int)strlen(sql);
+    int failed = command_service_run_command(session, COM_QUERY, &cmd, NULL, &vi_load_cbs,
+                                             CS_TEXT_REPRESENTATION, lc);
+    srv_session_close(session);
+    if (failed && !lc->error[0]) snprintf(lc->error, sizeof(lc->error), "query failed: %s", sql);
+    return !failed && !lc->error[0];
+}
+
+/*
+ * Builds a new set aside and swaps it in. The log holds writes made while
+ * the SELECT ran; replaying them after the snapshot leaves every id at its
+ * latest state (ops before the snapshot are replayed too, harmlessly).
+ */
+static void *vi_loader_main(void *arg) {
+    vi_index *ix = (vi_index *)arg;
+    vi_load_ctx lc;
+    memset(&lc, 0, sizeof(lc));
+    lc.ix = ix;
+    lc.set = (vi_set *)calloc(1, sizeof(vi_set));
+
+    if (srv_session_init_thread(vi_plugin) != 0) {
+        snprintf(lc.error, sizeof(lc.error), "srv_session_init_thread failed");
+    } else {
+        while (!vi_shutdown && !srv_session_server_is_available()) sleep(1);
+        if (!vi_shutdown && lc.set && vi_load_table(&lc) && !vi_set_train(lc.set, (int)vi_sys_nlist))
+            snprintf(lc.error, sizeof(lc.error), "out of memory training the index");
+        srv_session_deinit_thread();
+    }
+
+    pthread_rwlock_wrlock(&ix->lock);
+    if (lc.error[0] || vi_shutdown || !lc.set) {
+        snprintf(ix->error, sizeof(ix->error), "%s", lc.error[0] ? lc.error : "load interrupted");
+        vi_set_free(lc.set);
+    } else {
+        for (int i = 0; i < ix->log_count; i++) {
+            vi_op *op = &ix->log[i];
+            if (op->vec) vi_set_upsert(lc.set, op->id, op->vec, op->dim);
+            else vi_set_delete(lc.set, op->id);
+        }
+        if (!ix->live) __atomic_add_fetch(&vi_stat_ready, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&vi_stat_rows, (long long)lc.set->count - (ix->live ? ix->live->count : 0), __ATOMIC_RELAXED);
+        vi_set_free(ix->live);
+        ix->live = lc.set;
+        ix->error[0] = '\0';
+    }
+    vi_log_free(ix);
+    ix->loading = 0;
+    pthread_rwlock_unlock(&ix->lock);
+    return NULL;
+}
+
+/* Called with the write lock held; 0 if a load is already running */
+static int vi_start_load(vi_index *ix) {
+    if (ix->loading) return 0;
+    if (ix->loader_started) pthread_join(ix->loader, NULL);
+    ix->loading = 1;
+    ix->loaded_rows = 0;
+    ix->loader_started = pthread_create(&ix->loader, NULL, vi_loader_main, ix) == 0;
+    if (!ix->loader_started) {
+        ix->loading = 0;
+        snprintf(ix->error, sizeof(ix->error), "cannot start the loader thread");
+        return 0;
+    }
+    return 1;
+}
+
+/* =========================
+   Plugin
+   ========================= */
+
+static int vector_index_plugin_init(MYSQL_PLUGIN plugin) {
+    vi_plugin = plugin;
+    vi_shutdown = 0;
+    vi_index_count = 0;
+
+    /* vector_index_tables = db.table[,db.table...] */
+    const char *p = vi_sys_tables ? vi_sys_tables : "";
+    while (*p && vi_index_count < VI_MAX_TABLES) {
+        while (*p == ' ' || *p == ',') p++;
+        const char *end = p;
+        while (*end && *end != ',' && *end != ' ') end++;
+        size_t len = (size_t)(end - p);
+        const char *dot = memchr(p, '.', len);
+        if (len > 0 && len < VI_NAME_LEN && dot && dot > p && dot < end - 1) {
+            vi_index *ix = (vi_index *)calloc(1, sizeof(vi_index));
+            if (!ix) return 1;
+            memcpy(ix->name, p, len);
+            ix->table = ix->name + (dot - p) + 1;
+            pthread_rwlock_init(&ix->lock, NULL);
+            vi_indexes[vi_index_count++] = ix;
+            pthread_rwlock_wrlock(&ix->lock);
+            vi_start_load(ix);
+            pthread_rwlock_unlock(&ix->lock);
+        } else if (len > 0) {
+            fprintf(stderr, "vector_index: ignoring '%.*s' in vector_index_tables (expected db.table)\n", (int)len, p);
+        }
+        p = end;
+    }
+    return 0;
+}
+
+static int vector_index_plugin_deinit(MYSQL_PLUGIN plugin) {
+    (void)plugin;
+    vi_shutdown = 1;
+    for (int i = 0; i < vi_index_count; i++) {
+        vi_index *ix = vi_indexes[i];
+        if (ix->loader_started) pthread_join(ix->loader, NULL);
+        vi_set_free(ix->live);
+        vi_log_free(ix);
+        pthread_rwlock_destroy(&ix->lock);
+        free(ix);
+        vi_indexes[i] = NULL;
+    }
+    vi_index_count = 0;
+    vi_stat_rows = vi_stat_ready = 0;
+    return 0;
+}
+
+static MYSQL_SYSVAR_STR(tables, vi_sys_tables, PLUGIN_VAR_READONLY | PLUGIN_VAR_MEMALLOC,
+    "Tables to index at startup, as db.table[,db.table...]", NULL, NULL, "");
+static MYSQL_SYSVAR_STR(column, vi_sys_column, PLUGIN_VAR_READONLY | PLUGIN_VAR_MEMALLOC,
+    "float32 embedding column of the indexed tables", NULL, NULL, "embedding");
+static MYSQL_SYSVAR_STR(id_column, vi_sys_id_column, PLUGIN_VAR_READONLY | PLUGIN_VAR_MEMALLOC,
+    "Integer primary key column of the indexed tables", NULL, NULL, "id");
+static MYSQL_SYSVAR_STR(user, vi_sys_user, PLUGIN_VAR_READONLY | PLUGIN_VAR_MEMALLOC,
+    "Account (@localhost) whose SELECT privilege the loader uses", NULL, NULL, "root");
+static MYSQL_SYSVAR_UINT(nlist, vi_sys_nlist, PLUGIN_VAR_RQCMDARG,
+    "IVF lists per index, used by the next load (0 = sqrt(rows))", NULL, NULL, 0, 0, 65536, 0);
+static MYSQL_SYSVAR_UINT(nprobe, vi_sys_nprobe, PLUGIN_VAR_RQCMDARG,
+    "Lists probed per vector_knn() call (0 = nlist/16)", NULL, NULL, 0, 0, 65536, 0);
+
+static SYS_VAR *vi_system_vars[] = {
+    MYSQL_SYSVAR(tables),
+    MYSQL_SYSVAR(column),
+    MYSQL_SYSVAR(id_column),
+    MYSQL_SYSVAR(user),
+    MYSQL_SYSVAR(nlist),
+    MYSQL_SYSVAR(nprobe),
+    NULL
+};
+
+static SHOW_VAR vi_status_vars[] = {
+    {"vector_index_rows", (char *)&vi_stat_rows, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+    {"vector_index_ready", (char *)&vi_stat_ready, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+    {"vector_index_searches", (char *)&vi_stat_searches, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+    {"vector_index_inserts", (char *)&vi_stat_inserts, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+    {"vector_index_deletes", (char *)&vi_stat_deletes, SHOW_LONGLONG, SHOW_SCOPE_GLOBAL},
+    {NULL, NULL, SHOW_UNDEF, SHOW_SCOPE_UNDEF}
+};
+
+static struct st_mysql_daemon vector_index_descriptor = { MYSQL_DAEMON_INTERFACE_VERSION };
+
+mysql_declare_plugin(vector_index) {
+    MYSQL_DAEMON_PLUGIN,
+    &vector_index_descriptor,
+    "vector_index",
+    "tclembedding",
+    "In-memory IVF index of embedding columns for vector_knn()",
+    PLUGIN_LICENSE_BSD,
+    vector_index_plugin_init,
+    NULL,
+    vector_index_plugin_deinit,
+    0x0100,
+    vi_status_vars,
+    vi_system_vars,
+    NULL,
+    0,
+} mysql_declare_plugin_end;
+
+/* =========================
+   UDFs
+   ========================= */
+
+static vi_index *vi_index_arg(UDF_ARGS *args, char *message, const char *fname) {
+    if (!args->args[0]) {
+        snprintf(message, MYSQL_ERRMSG_SIZE, "%s(): the table name must be a constant", fname);
+        return NULL;
+    }
+    vi_index *ix = vi_find(args->args[0], args->lengths[0]);
+    if (!ix)
+        snprintf(message, MYSQL_ERRMSG_SIZE, "%s(): no vector index for '%.*s' (see vector_index_tables)",
+                 fname, (int)(args->lengths[0] > 64 ? 64 : args->lengths[0]), args->args[0]);
+    return ix;
+}
+
+/*
+ * vector_knn(table, query, k [, nprobe])
+ *
+ * JSON array of the ids of the k nearest rows, best first. With constant
+ * arguments (the usual case) the search runs once per statement.
+ */
+
+typedef struct {
+    vi_index *ix;
+    char *result;
+    unsigned long result_len;
+    int cached;
+    vi_hit *hits;
+    int k;
+} vi_knn_state;
+
+my_bool vector_knn_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count < 3 || args->arg_count > 4 ||
+        args->arg_type[0] != STRING_RESULT || args->arg_type[1] != STRING_RESULT) {
+        strcpy(message, "vector_knn(table, query, k [, nprobe])");
+        return 1;
+    }
+    args->arg_type[2] = INT_RESULT;
+    if (args->arg_count == 4) args->arg_type[3] = INT_RESULT;
+
+    vi_index *ix = vi_index_arg(args, message, "vector_knn");
+    if (!ix) return 1;
+
+    pthread_rwlock_rdlock(&ix->lock);
+    int ready = ix->live != NULL;
+    if (!ready) {
+        if (ix->loading)
+            snprintf(message, MYSQL_ERRMSG_SIZE, "vector_knn(): index for '%s' is still loading (%llu rows so far)",
+                     ix->name, __atomic_load_n(&ix->loaded_rows, __ATOMIC_RELAXED));
+        else
+            snprintf(message, MYSQL_ERRMSG_SIZE, "vector_knn(): index for '%s' failed to load: %s", ix->name, ix->error);
+    }
+    pthread_rwlock_unlock(&ix->lock);
+    if (!ready) return 1;
+
+    vi_knn_state *st = (vi_knn_state *)calloc(1, sizeof(vi_knn_state));
+    if (!st) {
+        strcpy(message, "vector_knn(): out of memory");
+        return 1;
+    }
+    st->ix = ix;
+    initid->ptr = (char *)st;
+    initid->maybe_null = 1;
+    initid->max_length = 65535;
+    return 0;
+}
+
+char *vector_knn(UDF_INIT *initid, UDF_ARGS *args, char *result, unsigned long *length,
+                 char *is_null, char *error) {
+    vi_knn_state *st = (vi_knn_state *)initid->ptr;
+    (void)result;
+    if (st->cached) {
+        *length = st->result_len;
+        return st->result;
+    }
+    if (!args->args[1] || !args->args[2]) {
+        *is_null = 1;
+        return NULL;
+    }
+
+    long long k = *(const long long *)args->args[2];
+    long long nprobe = (args->arg_count == 4 && args->args[3]) ? *(const long long *)args->args[3]
+                                                               : (long long)vi_sys_nprobe;
+    unsigned long qlen = args->lengths[1];
+    if (k <= 0 || k > VI_MAX_K || qlen == 0 || qlen % sizeof(float) != 0) {
+        *error = 1;
+        return NULL;
+    }
+    int dim = (int)(qlen / sizeof(float));
+
+    if (k > st->k) {
+        vi_hit *hits = (vi_hit *)realloc(st->hits, sizeof(vi_hit) * k);
+        char *buf = (char *)realloc(st->result, (size_t)k * 21 + 3);
+        if (hits) st->hits = hits;
+        if (buf) st->result = buf;
+        if (!hits || !buf) {
+            *error = 1;
+            return NULL;
+        }
+        st->k = (int)k;
+    }
+    float *query = (float *)malloc(qlen);
+    if (!query || !vi_normalize(query, (const float *)memcpy(query, args->args[1], qlen), dim)) {
+        free(query);
+        *is_null = 1;
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&st->ix->lock);
+    int n = -1;
+    if (st->ix->live && st->ix->live->dim == dim)
+        n = vi_set_search(st->ix->live, query, (int)k, (int)nprobe, st->hits);
+    pthread_rwlock_unlock(&st->ix->lock);
+    free(query);
+    if (n < 0) {
+        *error = 1;
+        return NULL;
+    }
+    __atomic_add_fetch(&vi_stat_searches, 1, __ATOMIC_RELAXED);
+
+    char *p = st->result;
+    *p++ = '[';
+    for (int i = 0; i < n; i++)
+        p += sprintf(p, i ? ",%lld" : "%lld", st->hits[i].id);
+    *p++ = ']';
+    st->result_len = (unsigned long)(p - st->result);
+    st->cached = args->args[0] && args->args[1] && args->args[2] &&
+                 (args->arg_count == 3 || args->args[3]) && initid->const_item;
+    *length = st->result_len;
+    return st->result;
+}
+
+void vector_knn_deinit(UDF_INIT *initid) {
+    vi_knn_state *st = (vi_knn_state *)initid->ptr;
+    if (!st) return;
+    free(st->hits);
+    free(st->result);
+    free(st);
+}
+
+/*
+ * vector_index_insert(table, id, embedding) -> 1, or 0 if rejected
+ * (NULL, wrong dimension, zero vector). Upsert: also for UPDATE triggers.
+ */
+my_bool vector_index_insert_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 3 || args->arg_type[0] != STRING_RESULT || args->arg_type[2] != STRING_RESULT) {
+        strcpy(message, "vector_index_insert(table, id, embedding)");
+        return 1;
+    }
+    args->arg_type[1] = INT_RESULT;
+    vi_index *ix = vi_index_arg(args, message, "vector_index_insert");
+    if (!ix) return 1;
+    initid->ptr = (char *)ix;
+    return 0;
+}
+
+long long vector_index_insert(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error) {
+    vi_index *ix = (vi_index *)initid->ptr;
+    (void)is_null; (void)error;
+    unsigned long len = args->lengths[2];
+    if (!args->args[1] || !args->args[2] || len == 0 || len % sizeof(float) != 0)
+        return 0;
+    long long id = *(const long long *)args->args[1];
+    int dim = (int)(len / sizeof(float));
+    float *vec = (float *)malloc(len);
+    if (!vec) return 0;
+    memcpy(vec, args->args[2], len);
+
+    int ok = 1;
+    pthread_rwlock_wrlock(&ix->lock);
+    if (ix->live) {
+        int existed = vi_map_find(ix->live, id) >= 0;
+        ok = vi_set_upsert(ix->live, id, vec, dim);
+        if (ok && !existed) __atomic_add_fetch(&vi_stat_rows, 1, __ATOMIC_RELAXED);
+    }
+    if (ix->loading) vi_log_append(ix, id, vec, dim);
+    pthread_rwlock_unlock(&ix->lock);
+    free(vec);
+    if (ok) __atomic_add_fetch(&vi_stat_inserts, 1, __ATOMIC_RELAXED);
+    return ok;
+}
+
+/* vector_index_delete(table, id) -> 1 if the id was indexed */
+my_bool vector_index_delete_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 2 || args->arg_type[0] != STRING_RESULT) {
+        strcpy(message, "vector_index_delete(table, id)");
+        return 1;
+    }
+    args->arg_type[1] = INT_RESULT;
+    vi_index *ix = vi_index_arg(args, message, "vector_index_delete");
+    if (!ix) return 1;
+    initid->ptr = (char *)ix;
+    return 0;
+}
+
+long long vector_index_delete(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error) {
+    vi_index *ix = (vi_index *)initid->ptr;
+    (void)is_null; (void)error;
+    if (!args->args[1]) return 0;
+    long long id = *(const long long *)args->args[1];
+
+    int removed = 0;
+    pthread_rwlock_wrlock(&ix->lock);
+    if (ix->live && vi_set_delete(ix->live, id)) {
+        removed = 1;
+        __atomic_sub_fetch(&vi_stat_rows, 1, __ATOMIC_RELAXED);
+    }
+    if (ix->loading) vi_log_append(ix, id, NULL, 0);
+    pthread_rwlock_unlock(&ix->lock);
+    __atomic_add_fetch(&vi_stat_deletes, 1, __ATOMIC_RELAXED);
+    return removed;
+}
+
+/*
+ * vector_index_reload(table) -> 1 if a reload started, 0 if one is running.
+ * Re-reads the table and retrains the lists (vector_index_nlist) in the
+ * background; the current index keeps serving until the swap.
+ */
+my_bool vector_index_reload_init(UDF_INIT *initid, UDF_ARGS *args, char *message) {
+    if (args->arg_count != 1 || args->arg_type[0] != STRING_RESULT) {
+        strcpy(message, "vector_index_reload(table)");
+        return 1;
+    }
+    vi_index *ix = vi_index_arg(args, message, "vector_index_reload");
+    if (!ix) return 1;
+    initid->ptr = (char *)ix;
+    return 0;
+}
+
+long long vector_index_reload(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error) {
+    vi_index *ix = (vi_index *)initid->ptr;
+    (void)args; (void)is_null; (void)error;
+    pthread_rwlock_wrlock(&ix->lock);
+    int started = vi_start_load(ix);
+    pthread_rwlock_unlock(&ix->lock);
+    return started;
+}
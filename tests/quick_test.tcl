@@ -3,7 +3,7 @@
 # quick_test.tcl - TEA installation validation without database
 # Shows complete flow: Text -> Tokens -> Vector -> Math
 
-package require Tcl 8.6
+package require Tcl 8.6-
 # If TEA is installed correctly, this should work directly:
 if {[catch {package require tclembedding} err]} {
     puts "❌ ERROR: Cannot load tclembedding. Did you run 'make install'?"
@@ -0,0 +1,630 @@
+/*
+ * bake_pooling.c - Append mean pooling + L2 normalization to an ONNX model
+ *
+ * embedding::compute pools on the host: ORT hands back the whole
+ * last_hidden_state {B, T, D} and the extension averages it. This tool
+ * rewrites a model so the graph does it instead and exposes a
+ * "sentence_embedding" {B, D} output:
+ *
+ *   mask   = Unsqueeze(Cast(attention_mask, float), 2)       {B, T, 1}
+ *   summed = ReduceSum(last_hidden_state * mask, axes=[1])   {B, D}
+ *   count  = Max(ReduceSum(mask, axes=[1]), 1e-9)            {B, 1}
+ *   sentence_embedding = LpNormalization(summed / count, p=2)
+ *
+ * ORT then only returns D floats per text and can fuse the subgraph with
+ * the rest of the model. The rewritten model is tagged with the metadata
+ * entry tclembedding.pooling = mean_l2; embedding::init_raw looks for it
+ * and skips host pooling for such models. last_hidden_state stays as an
+ * output, so the model still works with code that pools by itself.
+ *
+ * With -layers N the encoder is also cut after layer N, for a cheaper
+ * early-exit model from the same weights: layer N's output becomes
+ * last_hidden_state (through an Identity node), the other graph outputs
+ * are dropped, and so are the nodes and initializers they alone needed,
+ * so ORT never runs the later layers. The cut tensor is -hidden if given,
+ * else a graph output hidden_states.N, else the HuggingFace BERT export
+ * name /encoder/layer.<N-1>/output/LayerNorm/Add_1_output_0. The model is
+ * tagged tclembedding.layers = N, which embedding::init_raw reports.
+ *
+ * The ONNX file is edited at the protobuf wire level: the new nodes,
+ * initializers and output are appended to the GraphProto and everything
+ * else is copied byte for byte. No protobuf or onnx library is needed.
+ * Models with external data keep referring to the same data files.
+ *
+ * USAGE:
+ *   ./bake_pooling in.onnx out.onnx [-hidden last_hidden_state] [-mask attention_mask] [-layers N]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_NAME   "sentence_embedding"
+#define METADATA_KEY  "tclembedding.pooling"
+#define METADATA_VAL  "mean_l2"
+#define LAYERS_KEY    "tclembedding.layers"
+#define HIDDEN_NAME   "last_hidden_state"
+#define PREFIX        "tclembedding_pool/"
+
+/* onnx.proto field numbers */
+enum {
+    MODEL_GRAPH = 7, MODEL_OPSET_IMPORT = 8, MODEL_METADATA_PROPS = 14,
+    GRAPH_NODE = 1, GRAPH_INITIALIZER = 5, GRAPH_INPUT = 11, GRAPH_OUTPUT = 12,
+    NODE_INPUT = 1, NODE_OUTPUT = 2, NODE_NAME = 3, NODE_OP_TYPE = 4, NODE_ATTRIBUTE = 5,
+    ATTR_NAME = 1, ATTR_I = 3, ATTR_G = 6, ATTR_INTS = 8, ATTR_GRAPHS = 11, ATTR_TYPE = 20,
+    TENSOR_DIMS = 1, TENSOR_DATA_TYPE = 2, TENSOR_NAME = 8, TENSOR_RAW_DATA = 9,
+    VALUE_INFO_NAME = 1, VALUE_INFO_TYPE = 2,
+    TYPE_TENSOR = 1, TENSOR_TYPE_ELEM = 1, TENSOR_TYPE_SHAPE = 2,
+    SHAPE_DIM = 1, DIM_PARAM = 2,
+    OPSET_DOMAIN = 1, OPSET_VERSION = 2,
+    ENTRY_KEY = 1, ENTRY_VALUE = 2
+};
+
+enum { ATTR_TYPE_INT = 2, ATTR_TYPE_INTS = 7 };
+enum { ELEM_FLOAT = 1, ELEM_INT64 = 7 };
+enum { WIRE_VARINT = 0, WIRE_FIXED64 = 1, WIRE_LEN = 2, WIRE_FIXED32 = 5 };
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "bake_pooling: %s%s%s\n", msg, arg ? " " : "", arg ? arg : "");
+    exit(1);
+}
+
+/* =========================
+   Protobuf writer
+   ========================= */
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+static void put_raw(buf_t *b, const void *p, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + n) cap *= 2;
+        unsigned char *data = (unsigned char *)realloc(b->data, cap);
+        if (!data) die("out of memory", NULL);
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+static void put_varint(buf_t *b, uint64_t v) {
+    unsigned char tmp[10];
+    int n = 0;
+    do {
+        tmp[n] = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if (v) tmp[n] |= 0x80;
+        n++;
+    } while (v);
+    put_raw(b, tmp, n);
+}
+
+static void put_tag(buf_t *b, int field, int wire) {
+    put_varint(b, ((uint64_t)field << 3) | (uint64_t)wire);
+}
+
+static void put_int(buf_t *b, int field, int64_t v) {
+    put_tag(b, field, WIRE_VARINT);
+    put_varint(b, (uint64_t)v);
+}
+
+static void put_bytes(buf_t *b, int field, const void *p, size_t n) {
+    put_tag(b, field, WIRE_LEN);
+    put_varint(b, n);
+    put_raw(b, p, n);
+}
+
+static void put_string(buf_t *b, int field, const char *s) {
+    put_bytes(b, field, s, strlen(s));
+}
+
+/* Embeds `msg` as field `field` of `b` and empties it */
+static void put_msg(buf_t *b, int field, buf_t *msg) {
+    put_bytes(b, field, msg->data, msg->len);
+    msg->len = 0;
+}
+
+/* =========================
+   Protobuf reader
+   ========================= */
+
+typedef struct {
+    int field;
+    int wire;
+    uint64_t value;                 /* WIRE_VARINT */
+    const unsigned char *data;      /* WIRE_LEN */
+    size_t len;
+    const unsigned char *start;     /* First byte of the tag */
+} field_t;
+
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint64_t *v) {
+    uint64_t r = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char c = *p++;
+        r |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = r;
+            return p;
+        }
+    }
+    die("malformed protobuf (varint)", NULL);
+    return NULL;
+}
+
+/* Reads the next field at *p; 0 at the end of the message */
+static int next_field(const unsigned char **p, const unsigned char *end, field_t *f) {
+    if (*p >= end) return 0;
+    uint64_t key;
+    f->start = *p;
+    *p = get_varint(*p, end, &key);
+    f->field = (int)(key >> 3);
+    f->wire = (int)(key & 7);
+    switch (f->wire) {
+    case WIRE_VARINT:
+        *p = get_varint(*p, end, &f->value);
+        break;
+    case WIRE_FIXED64:
+        if (end - *p < 8) die("malformed protobuf (fixed64)", NULL);
+        *p += 8;
+        break;
+    case WIRE_FIXED32:
+        if (end - *p < 4) die("malformed protobuf (fixed32)", NULL);
+        *p += 4;
+        break;
+    case WIRE_LEN:
+        *p = get_varint(*p, end, &f->value);
+        if ((uint64_t)(end - *p) < f->value) die("malformed protobuf (length)", NULL);
+        f->data = *p;
+        f->len = (size_t)f->value;
+        *p += f->len;
+        break;
+    default:
+        die("unsupported protobuf wire type", NULL);
+    }
+    return 1;
+}
+
+static int field_equals(const field_t *f, const char *s) {
+    return f->wire == WIRE_LEN && f->len == strlen(s) && memcmp(f->data, s, f->len) == 0;
+}
+
+/* Whether some string field `field` of a message equals s */
+static int message_has_string(const unsigned char *p, size_t len, int field, const char *s) {
+    const unsigned char *end = p + len;
+    field_t f;
+    while (next_field(&p, end, &f))
+        if (f.field == field && field_equals(&f, s)) return 1;
+    return 0;
+}
+
+/*
+ * Element type of a tensor ValueInfoProto (0 if unknown) and up to 3 of
+ * its TensorShapeProto.Dimension entries, as encoded bytes
+ */
+static int value_info_tensor(const unsigned char *p, size_t len, field_t dims[3], int *ndims) {
+    const unsigned char *end = p + len;
+    field_t f, t, e, d;
+    int elem = 0;
+    *ndims = 0;
+    while (next_field(&p, end, &f)) {
+        if (f.field != VALUE_INFO_TYPE || f.wire != WIRE_LEN) continue;
+        const unsigned char *q = f.data, *qend = f.data + f.len;
+        while (next_field(&q, qend, &t)) {
+            if (t.field != TYPE_TENSOR || t.wire != WIRE_LEN) continue;
+            const unsigned char *r = t.data, *rend = t.data + t.len;
+            while (next_field(&r, rend, &e)) {
+                if (e.field == TENSOR_TYPE_ELEM && e.wire == WIRE_VARINT) elem = (int)e.value;
+                if (e.field != TENSOR_TYPE_SHAPE || e.wire != WIRE_LEN) continue;
+                const unsigned char *s = e.data, *send = e.data + e.len;
+                while (next_field(&s, send, &d))
+                    if (d.field == SHAPE_DIM && d.wire == WIRE_LEN && *ndims < 3) dims[(*ndims)++] = d;
+            }
+        }
+    }
+    return elem;
+}
+
+/* =========================
+   Graph additions
+   ========================= */
+
+static void attr_int(buf_t *attrs, const char *name, int64_t v) {
+    buf_t a = {0};
+    put_string(&a, ATTR_NAME, name);
+    put_int(&a, ATTR_TYPE, ATTR_TYPE_INT);
+    put_int(&a, ATTR_I, v);
+    put_msg(attrs, NODE_ATTRIBUTE, &a);
+    free(a.data);
+}
+
+static void attr_ints(buf_t *attrs, const char *name, int64_t v) {
+    buf_t a = {0};
+    put_string(&a, ATTR_NAME, name);
+    put_int(&a, ATTR_TYPE, ATTR_TYPE_INTS);
+    put_int(&a, ATTR_INTS, v);
+    put_msg(attrs, NODE_ATTRIBUTE, &a);
+    free(a.data);
+}
+
+/* Appends a node; attrs holds already-encoded NODE_ATTRIBUTE fields */
+static void add_node(buf_t *graph, const char *op, const char *in0, const char *in1,
+                     const char *out, buf_t *attrs) {
+    buf_t n = {0};
+    char name[128];
+    put_string(&n, NODE_INPUT, in0);
+    if (in1) put_string(&n, NODE_INPUT, in1);
+    put_string(&n, NODE_OUTPUT, out);
+    snprintf(name, sizeof(name), "%s%s", strncmp(out, PREFIX, strlen(PREFIX)) ? PREFIX : "", out);
+    put_string(&n, NODE_NAME, name);
+    put_string(&n, NODE_OP_TYPE, op);
+    if (attrs && attrs->len) put_raw(&n, attrs->data, attrs->len);
+    if (attrs) attrs->len = 0;
+    put_msg(graph, GRAPH_NODE, &n);
+    free(n.data);
+}
+
+static void add_initializer(buf_t *graph, const char *name, int elem, int rank1,
+                            const void *raw, size_t raw_len) {
+    buf_t t = {0};
+    if (rank1) put_int(&t, TENSOR_DIMS, 1);
+    put_int(&t, TENSOR_DATA_TYPE, elem);
+    put_string(&t, TENSOR_NAME, name);
+    put_bytes(&t, TENSOR_RAW_DATA, raw, raw_len);   /* little-endian, as ONNX requires */
+    put_msg(graph, GRAPH_INITIALIZER, &t);
+    free(t.data);
+}
+
+static void put_dim_param(buf_t *shape, const char *param) {
+    buf_t d = {0};
+    put_string(&d, DIM_PARAM, param);
+    put_msg(shape, SHAPE_DIM, &d);
+    free(d.data);
+}
+
+/* float {batch, D}, with the batch and D dimensions of the hidden state */
+static void add_output(buf_t *graph, const char *name, const field_t *hidden_dims, int ndims) {
+    buf_t shape = {0}, tensor = {0}, type = {0}, vi = {0};
+    if (ndims == 3) {
+        put_bytes(&shape, SHAPE_DIM, hidden_dims[0].data, hidden_dims[0].len);
+        put_bytes(&shape, SHAPE_DIM, hidden_dims[2].data, hidden_dims[2].len);
+    } else {
+        put_dim_param(&shape, "batch");
+        put_dim_param(&shape, "dim");
+    }
+    put_int(&tensor, TENSOR_TYPE_ELEM, ELEM_FLOAT);
+    put_msg(&tensor, TENSOR_TYPE_SHAPE, &shape);
+    put_msg(&type, TYPE_TENSOR, &tensor);
+    put_string(&vi, VALUE_INFO_NAME, name);
+    put_msg(&vi, VALUE_INFO_TYPE, &type);
+    put_msg(graph, GRAPH_OUTPUT, &vi);
+    free(shape.data);
+    free(tensor.data);
+    free(type.data);
+    free(vi.data);
+}
+
+/*
+ * Opset 13 moved the axes of Unsqueeze and ReduceSum from attributes to
+ * inputs; both forms are emitted depending on the model's opset.
+ */
+static void build_pooling(buf_t *graph, int opset, const char *hidden, int hidden_elem,
+                          const field_t *hidden_dims, int ndims, const char *mask) {
+    buf_t attrs = {0};
+    const char *h = hidden;
+
+    if (hidden_elem != ELEM_FLOAT) {
+        attr_int(&attrs, "to", ELEM_FLOAT);
+        add_node(graph, "Cast", hidden, NULL, PREFIX "hidden_f", &attrs);
+        h = PREFIX "hidden_f";
+    }
+    attr_int(&attrs, "to", ELEM_FLOAT);
+    add_node(graph, "Cast", mask, NULL, PREFIX "mask_f", &attrs);
+
+    float eps = 1e-9f;
+    add_initializer(graph, PREFIX "eps", ELEM_FLOAT, 0, &eps, sizeof(eps));
+
+    if (opset >= 13) {
+        int64_t axis2 = 2, axis1 = 1;
+        add_initializer(graph, PREFIX "axes_2", ELEM_INT64, 1, &axis2, sizeof(axis2));
+        add_initializer(graph, PREFIX "axes_1", ELEM_INT64, 1, &axis1, sizeof(axis1));
+        add_node(graph, "Unsqueeze", PREFIX "mask_f", PREFIX "axes_2", PREFIX "mask_3", NULL);
+        add_node(graph, "Mul", h, PREFIX "mask_3", PREFIX "masked", NULL);
+        attr_int(&attrs, "keepdims", 0);
+        add_node(graph, "ReduceSum", PREFIX "masked", PREFIX "axes_1", PREFIX "summed", &attrs);
+        attr_int(&attrs, "keepdims", 0);
+        add_node(graph, "ReduceSum", PREFIX "mask_3", PREFIX "axes_1", PREFIX "count", &attrs);
+    } else {
+        attr_ints(&attrs, "axes", 2);
+        add_node(graph, "Unsqueeze", PREFIX "mask_f", NULL, PREFIX "mask_3", &attrs);
+        add_node(graph, "Mul", h, PREFIX "mask_3", PREFIX "masked", NULL);
+        attr_ints(&attrs, "axes", 1);
+        attr_int(&attrs, "keepdims", 0);
+        add_node(graph, "ReduceSum", PREFIX "masked", NULL, PREFIX "summed", &attrs);
+        attr_ints(&attrs, "axes", 1);
+        attr_int(&attrs, "keepdims", 0);
+        add_node(graph, "ReduceSum", PREFIX "mask_3", NULL, PREFIX "count", &attrs);
+    }
+    add_node(graph, "Max", PREFIX "count", PREFIX "eps", PREFIX "count_c", NULL);
+    add_node(graph, "Div", PREFIX "summed", PREFIX "count_c", PREFIX "mean", NULL);
+    attr_int(&attrs, "axis", -1);
+    attr_int(&attrs, "p", 2);
+    add_node(graph, "LpNormalization", PREFIX "mean", NULL, OUTPUT_NAME, &attrs);
+    add_output(graph, OUTPUT_NAME, hidden_dims, ndims);
+    free(attrs.data);
+}
+
+/* =========================
+   Cutting at layer N
+   ========================= */
+
+/* Set of tensor names (pointers into the model bytes); linear search is
+   fine for the few thousand names of an encoder */
+typedef struct {
+    field_t *names;
+    size_t count;
+    size_t cap;
+} names_t;
+
+static int names_has(const names_t *set, const unsigned char *p, size_t len) {
+    for (size_t i = 0; i < set->count; i++)
+        if (set->names[i].len == len && memcmp(set->names[i].data, p, len) == 0) return 1;
+    return 0;
+}
+
+static void names_add(names_t *set, const field_t *f) {
+    if (names_has(set, f->data, f->len)) return;
+    if (set->count == set->cap) {
+        set->cap = set->cap ? set->cap * 2 : 256;
+        set->names = (field_t *)realloc(set->names, set->cap * sizeof(field_t));
+        if (!set->names) die("out of memory", NULL);
+    }
+    set->names[set->count++] = *f;
+}
+
+/* Whether some node in the graph produces `name` */
+static int graph_produces(const unsigned char *p, size_t len, const char *name) {
+    const unsigned char *end = p + len;
+    field_t f;
+    while (next_field(&p, end, &f))
+        if (f.field == GRAPH_NODE && f.wire == WIRE_LEN &&
+            message_has_string(f.data, f.len, NODE_OUTPUT, name)) return 1;
+    return 0;
+}
+
+/*
+ * New graph bytes without the nodes after `cut`: keeps the nodes `cut`
+ * depends on (ONNX nodes are topologically sorted, so one backward pass
+ * finds them) and their initializers, drops every graph output, and adds
+ * Identity(cut) -> last_hidden_state as the only output, described by the
+ * original last_hidden_state output `hidden_vi`.
+ */
+static void cut_graph(buf_t *out, const field_t *graph, const char *cut, const field_t *hidden_vi) {
+    const unsigned char *p = graph->data, *end = graph->data + graph->len;
+    field_t f, *nodes = NULL;
+    size_t nnodes = 0, cap = 0, kept = 0;
+    names_t inits = {0};
+    while (next_field(&p, end, &f)) {
+        if (f.field == GRAPH_INITIALIZER && f.wire == WIRE_LEN) {
+            const unsigned char *q = f.data, *qend = f.data + f.len;
+            field_t t;
+            while (next_field(&q, qend, &t))
+                if (t.field == TENSOR_NAME && t.wire == WIRE_LEN) names_add(&inits, &t);
+        }
+        if (f.field != GRAPH_NODE || f.wire != WIRE_LEN) continue;
+        if (nnodes == cap) {
+            cap = cap ? cap * 2 : 1024;
+            nodes = (field_t *)realloc(nodes, cap * sizeof(field_t));
+            if (!nodes) die("out of memory", NULL);
+        }
+        nodes[nnodes++] = f;
+    }
+
+    names_t needed = {0};
+    field_t seed = {0};
+    seed.data = (const unsigned char *)cut;
+    seed.len = strlen(cut);
+    names_add(&needed, &seed);
+
+    unsigned char *keep = (unsigned char *)calloc(nnodes ? nnodes : 1, 1);
+    if (!keep) die("out of memory", NULL);
+    for (size_t i = nnodes; i-- > 0;) {
+        const unsigned char *q = nodes[i].data, *qend = nodes[i].data + nodes[i].len;
+        field_t n;
+        while (next_field(&q, qend, &n))
+            if (n.field == NODE_OUTPUT && names_has(&needed, n.data, n.len)) keep[i] = 1;
+        if (!keep[i]) continue;
+        kept++;
+        q = nodes[i].data;
+        while (next_field(&q, qend, &n)) {
+            if (n.field == NODE_INPUT && n.len > 0) names_add(&needed, &n);
+            /* Subgraphs may read outer tensors without listing them as inputs */
+            if (n.field == NODE_ATTRIBUTE && n.wire == WIRE_LEN) {
+                const unsigned char *a = n.data, *aend = n.data + n.len;
+                field_t af;
+                while (next_field(&a, aend, &af))
+                    if (af.field == ATTR_G || af.field == ATTR_GRAPHS) die("-layers does not support subgraphs before the cut", NULL);
+            }
+        }
+    }
+
+    size_t node = 0;
+    p = graph->data;
+    while (next_field(&p, end, &f)) {
+        if (f.field == GRAPH_NODE && f.wire == WIRE_LEN) {
+            if (keep[node++]) put_raw(out, f.start, (size_t)(p - f.start));
+        } else if (f.field == GRAPH_INITIALIZER && f.wire == WIRE_LEN) {
+            const unsigned char *q = f.data, *qend = f.data + f.len;
+            field_t t;
+            int used = 0;
+            while (next_field(&q, qend, &t))
+                if (t.field == TENSOR_NAME && names_has(&needed, t.data, t.len)) used = 1;
+            if (used) put_raw(out, f.start, (size_t)(p - f.start));
+        } else if (f.field == GRAPH_INPUT && f.wire == WIRE_LEN) {
+            /* Older exports also list every initializer as an input */
+            const unsigned char *q = f.data, *qend = f.data + f.len;
+            field_t t;
+            int dropped = 0;
+            while (next_field(&q, qend, &t))
+                if (t.field == VALUE_INFO_NAME && names_has(&inits, t.data, t.len) &&
+                    !names_has(&needed, t.data, t.len)) dropped = 1;
+            if (!dropped) put_raw(out, f.start, (size_t)(p - f.start));
+        } else if (f.field != GRAPH_OUTPUT) {
+            put_raw(out, f.start, (size_t)(p - f.start));
+        }
+    }
+    add_node(out, "Identity", cut, NULL, HIDDEN_NAME, NULL);
+    put_raw(out, hidden_vi->start, (size_t)(hidden_vi->data + hidden_vi->len - hidden_vi->start));
+
+    fprintf(stderr, "cut at \"%s\": kept %zu of %zu nodes\n", cut, kept, nnodes);
+    free(keep);
+    free(nodes);
+    free(needed.names);
+    free(inits.names);
+}
+
+/* =========================
+   Main
+   ========================= */
+
+static unsigned char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) die("cannot open", path);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0) die("empty file", path);
+    unsigned char *data = (unsigned char *)malloc((size_t)size);
+    if (!data) die("out of memory", NULL);
+    if (fread(data, 1, (size_t)size, f) != (size_t)size) die("cannot read", path);
+    fclose(f);
+    *len = (size_t)size;
+    return data;
+}
+
+int main(int argc, char **argv) {
+    const char *hidden = NULL, *mask = "attention_mask";
+    int layers = 0;
+    if (argc < 3 || argc % 2 == 0) {
+        fprintf(stderr, "usage: bake_pooling in.onnx out.onnx [-hidden last_hidden_state] [-mask attention_mask] [-layers N]\n");
+        return 1;
+    }
+    for (int i = 3; i < argc; i += 2) {
+        if (!strcmp(argv[i], "-hidden")) hidden = argv[i + 1];
+        else if (!strcmp(argv[i], "-mask")) mask = argv[i + 1];
+        else if (!strcmp(argv[i], "-layers")) {
+            layers = atoi(argv[i + 1]);
+            if (layers < 1) die("-layers must be >= 1, got", argv[i + 1]);
+        }
+        else die("unknown option", argv[i]);
+    }
+
+    /* With -layers, -hidden names the tensor to cut at and the pooling
+       reads the new last_hidden_state */
+    const char *cut = NULL;
+    char layer_output[64], layer_tensor[128];
+    if (layers) {
+        cut = hidden;
+        hidden = HIDDEN_NAME;
+        snprintf(layer_output, sizeof(layer_output), "hidden_states.%d", layers);
+        snprintf(layer_tensor, sizeof(layer_tensor), "/encoder/layer.%d/output/LayerNorm/Add_1_output_0", layers - 1);
+    } else if (!hidden) {
+        hidden = HIDDEN_NAME;
+    }
+
+    size_t len;
+    unsigned char *model = read_file(argv[1], &len);
+    const unsigned char *p = model, *end = model + len;
+
+    /* ModelProto: find the graph and the default-domain opset */
+    field_t f, graph = {0};
+    int opset = 0;
+    while (next_field(&p, end, &f)) {
+        if (f.field == MODEL_GRAPH && f.wire == WIRE_LEN) {
+            graph = f;
+        } else if (f.field == MODEL_OPSET_IMPORT && f.wire == WIRE_LEN) {
+            const unsigned char *q = f.data, *qend = f.data + f.len;
+            field_t o;
+            int default_domain = 1, version = 0;
+            while (next_field(&q, qend, &o)) {
+                if (o.field == OPSET_DOMAIN && o.len > 0 && !field_equals(&o, "ai.onnx")) default_domain = 0;
+                if (o.field == OPSET_VERSION && o.wire == WIRE_VARINT) version = (int)o.value;
+            }
+            if (default_domain) opset = version;
+        } else if (f.field == MODEL_METADATA_PROPS && f.wire == WIRE_LEN &&
+                   message_has_string(f.data, f.len, ENTRY_KEY, METADATA_KEY)) {
+            die("model already has pooling baked in:", argv[1]);
+        }
+    }
+    if (!graph.data) die("no graph in", argv[1]);
+    if (opset < 9) die("model opset must be >= 9", NULL);
+
+    /* GraphProto: the hidden state must be an output, the mask an input */
+    int hidden_elem = -1, have_mask = 0, ndims = 0, have_layer_output = 0;
+    field_t hidden_dims[3], hidden_vi = {0};
+    p = graph.data;
+    end = graph.data + graph.len;
+    while (next_field(&p, end, &f)) {
+        if (f.wire != WIRE_LEN) continue;
+        if (f.field == GRAPH_OUTPUT && message_has_string(f.data, f.len, VALUE_INFO_NAME, hidden)) {
+            hidden_elem = value_info_tensor(f.data, f.len, hidden_dims, &ndims);
+            hidden_vi = f;
+        }
+        if (layers && f.field == GRAPH_OUTPUT && message_has_string(f.data, f.len, VALUE_INFO_NAME, layer_output))
+            have_layer_output = 1;
+        if (f.field == GRAPH_OUTPUT && message_has_string(f.data, f.len, VALUE_INFO_NAME, OUTPUT_NAME))
+            die("model already has an output named", OUTPUT_NAME);
+        if (f.field == GRAPH_INPUT && message_has_string(f.data, f.len, VALUE_INFO_NAME, mask))
+            have_mask = 1;
+    }
+    if (hidden_elem < 0) die("no graph output named", hidden);
+    if (!have_mask) die("no graph input named", mask);
+    if (layers && !cut) {
+        if (have_layer_output) cut = layer_output;
+        else if (graph_produces(graph.data, graph.len, layer_tensor)) cut = layer_tensor;
+        else die("no hidden_states output or HuggingFace layer output for -layers; pass -hidden with the tensor", NULL);
+    }
+    if (cut && !strcmp(cut, HIDDEN_NAME)) die("cannot cut at", HIDDEN_NAME);
+    if (cut && !graph_produces(graph.data, graph.len, cut)) die("no node produces", cut);
+
+    /* New graph = old graph bytes (or what is left before the cut) + appended fields */
+    buf_t new_graph = {0};
+    if (cut) cut_graph(&new_graph, &graph, cut, &hidden_vi);
+    else put_raw(&new_graph, graph.data, graph.len);
+    build_pooling(&new_graph, opset, hidden, hidden_elem, hidden_dims, ndims, mask);
+
+    buf_t out = {0};
+    put_raw(&out, model, (size_t)(graph.start - model));
+    put_bytes(&out, MODEL_GRAPH, new_graph.data, new_graph.len);
+    put_raw(&out, graph.data + graph.len, (size_t)(model + len - (graph.data + graph.len)));
+
+    buf_t entry = {0};
+    put_string(&entry, ENTRY_KEY, METADATA_KEY);
+    put_string(&entry, ENTRY_VALUE, METADATA_VAL);
+    put_msg(&out, MODEL_METADATA_PROPS, &entry);
+    if (layers) {
+        char value[16];
+        snprintf(value, sizeof(value), "%d", layers);
+        entry.len = 0;
+        put_string(&entry, ENTRY_KEY, LAYERS_KEY);
+        put_string(&entry, ENTRY_VALUE, value);
+        put_msg(&out, MODEL_METADATA_PROPS, &entry);
+    }
+
+    FILE *fo = fopen(argv[2], "wb");
+    if (!fo) die("cannot create", argv[2]);
+    if (fwrite(out.data, 1, out.len, fo) != out.len || fclose(fo) != 0) die("cannot write", argv[2]);
+
+    fprintf(stderr, "%s: opset %d, appended mean pooling + L2 normalization -> output \"%s\" (%zu -> %zu bytes)\n",
+            argv[2], opset, OUTPUT_NAME, len, out.len);
+    free(model);
+    free(new_graph.data);
+    free(out.data);
+    free(entry.data);
+    return 0;
+}
@@ -12,7 +12,8 @@
 # - Generating embeddings for text documents
 # - Converting embeddings to binary format for MySQL storage
 # - Proper SQL escaping for binary and text data
-# - Batch ingestion workflow
+# - Batch ingestion workflow (embedding::compute_batch)
+# - Optional online tuning of batch size and intra-op threads
 #
 # Dependencies:
 # - tclembedding    - Text embedding generation
@@ -24,7 +25,7 @@
 #
 #==============================================================================
 
-package require Tcl 8.6
+package require Tcl 8.6-
 package require tclembedding
 package require tokenizer
 package require mysqltcl
@@ -41,6 +42,12 @@ set base_dir   [file join $script_dir ".."]
 set model_onnx  [file join $base_dir "models" "e5-small" "model.onnx"]
 set model_vocab [file join $base_dir "models" "e5-small" "tokenizer.json"]
 
+# Optional PCA projection from embedding::pca_fit ("" = full model output).
+# Ingest and search must use the same file; set embedding_dim to its output.
+set model_projection ""
+set model_version "e5-small"   ;# Stored in youtube_rag.model_version
+set model_layers 0             ;# >0 = early exit at layer N (init_raw -layers)
+
 # MySQL Connection Configuration
 set db_host     "localhost"
 set db_user     "root"
@@ -49,7 +56,10 @@ set db_database "rag"
 
 # Ingestion parameters
 set embedding_dim 384          ;# Number of dimensions in embeddings
-set batch_size 100             ;# Documents to process before checkpoint
+set batch_size 32              ;# Documents per compute_batch call
+set intra_threads 1            ;# ONNX Runtime intra-op threads
+set pack_tokens 0              ;# >0 = compute_batch -pack (model with {B, T, T} mask)
+set autotune 0                 ;# 1 = tune batch_size/intra_threads online
 set verbose 1                  ;# Print progress messages
 
 # ============================================================================
@@ -103,125 +113,200 @@ puts "✓ Connected to MySQL database: $db_database"
 # EMBEDDING MODEL INITIALIZATION
 # ============================================================================
 
+#
+# open_model - Create an embedding handle with the given intra-op threads
+#
+# With autotune the handle is re-created whenever the thread count changes;
+# the model is memory-mapped so that only costs a new session, not a reload
+# of the weights. Prepacked weights are shared across the handles that are
+# alive at the same time, so the new handle is opened before the old one
+# is freed (see ingest_batch).
+#
+proc open_model {threads} {
+    global model_onnx model_projection model_layers autotune
+    set opts [list -threads $threads -mmap $autotune -layers $model_layers]
+    if {$model_projection ne ""} {
+        lappend opts -projection $model_projection
+    }
+    return [embedding::init_raw $model_onnx {*}$opts]
+}
+
 if {$verbose} {
     puts "🧠 Initializing embedding model (E5)..."
 }
 
 if {[catch {
     tokenizer::load_vocab $model_vocab
-    set handle [embedding::init_raw $model_onnx]
+    set handle [open_model $intra_threads]
 } err]} {
     puts "❌ Failed to initialize embedding model: $err"
     mysql::close $db
     exit 1
 }
 
+# Early-exit vectors are another space: the layer goes into model_version
+# (e5-small@L6) so search.tcl never scores them together with full-depth
+# ones. Also covers models cut with tools/bake_pooling -layers.
+set layers [dict get [embedding::reload $handle] layers]
+if {$layers > 0} {
+    append model_version "@L$layers"
+}
+
 puts "✓ Embedding model loaded successfully (dim=$embedding_dim)"
 
+set tuner ""
+if {$autotune} {
+    source [file join $base_dir "lib" "autotune.tcl"]
+    set tuner [autotune::new -batch $batch_size -thread $intra_threads]
+    puts "✓ Autotune enabled (start: batch $batch_size, threads $intra_threads)"
+}
+
 # ============================================================================
 # INGESTION PROCEDURE
 # ============================================================================
 
 #
-# ingest_document - Insert document with embedding into database
+# insert_document - Insert one document with its embedding into the database
 #
 # Arguments:
-#   db         - MySQL database handle
-#   categoria  - Document category (transcripcion, metadatos, comentario)
-#   texto      - Document content (text to be embedded)
+#   db          - MySQL database handle
+#   categoria   - Document category (transcripcion, metadatos, comentario)
+#   texto       - Document content
+#   binary_blob - Embedding as native float32 bytes
 #
 # Returns:
 #   1 on success, 0 on failure
 #
+proc insert_document {db categoria texto binary_blob} {
+    global model_version
+
+    # ─────────────────────────────────────────────────────────────────
+    # Escape data for SQL safety
+    # ─────────────────────────────────────────────────────────────────
+    #
+    # mysql::escape handles:
+    # - Quote escaping in text (remove ambiguity)
+    # - Null byte handling in binary data
+    # - Character encoding issues
+    #
+    # IMPORTANT: Always escape before inserting into SQL strings!
+    #
+    set esc_texto [mysql::escape $db $texto]
+    set esc_blob  [mysql::escape $db $binary_blob]
+
+    set esc_version [mysql::escape $db $model_version]
+
+    set sql "INSERT INTO youtube_rag (categoria, contenido, embedding, model_version) \
+             VALUES ('$categoria', '$esc_texto', '$esc_blob', '$esc_version')"
+
+    if {[catch {mysql::query $db $sql} err]} {
+        puts "❌ Database INSERT failed: $err"
+        return 0
+    }
+
+    return 1
+}
+
+#
+# ingest_batch - Embed a batch of documents in one call and insert them
+#
+# Arguments:
+#   db    - MySQL database handle
+#   docs  - List of dicts with keys categoria and texto
+#
+# Returns:
+#   Number of documents inserted
+#
 # Process:
-#   1. Prepend "passage: " prefix (required for E5 model)
-#   2. Generate embedding from text
-#   3. Convert embedding list to binary format
-#   4. Escape SQL special characters
-#   5. Insert into database
+#   1. Prepend "passage: " prefix (required for E5 model) and tokenize
+#   2. embedding::compute_batch -format binary: one inference call, one
+#      float32 slab with a row per document
+#   3. Slice each row and insert it
+#   4. With autotune, report docs/tokens/seconds and apply a new config
 #
-proc ingest_document {db categoria texto} {
-    global handle embedding_dim
+proc ingest_batch {db docs} {
+    global handle embedding_dim tuner batch_size intra_threads pack_tokens
+
+    set start [clock microseconds]
 
     # ─────────────────────────────────────────────────────────────────
-    # STEP 1: Prepare text with E5 prefix
+    # STEP 1: Tokenize with the E5 passage prefix
     # ─────────────────────────────────────────────────────────────────
     #
     # E5 models use different prefixes for different tasks:
     # - "passage: " for documents being indexed
     # - "query: " for search queries
     #
-    # This affects how embeddings are optimized for semantic search.
-    #
-    set texto_preparado "passage: $texto"
+    set token_lists [list]
+    set tokens 0
+    foreach doc $docs {
+        set ids [tokenizer::tokenize "passage: [dict get $doc texto]"]
+        lappend token_lists $ids
+        incr tokens [llength $ids]
+    }
 
     # ─────────────────────────────────────────────────────────────────
-    # STEP 2: Generate embedding vector
+    # STEP 2: Generate the embeddings
     # ─────────────────────────────────────────────────────────────────
     #
-    # tokenizer::tokenize + embedding::compute returns a Tcl list of floats
-    # Example: {0.123456 -0.234567 0.345678 ... } (384 elements)
+    # The slab holds len(docs) rows of dim native float32 values, the
+    # same bytes `binary format f*` would produce for each row.
     #
     if {[catch {
-        set tokens [tokenizer::tokenize $texto_preparado]
-        set embedding_list [embedding::compute $handle $tokens]
+        set slab [embedding::compute_batch $handle $token_lists -format binary -pack $pack_tokens]
     } err]} {
         puts "❌ Embedding generation failed: $err"
         return 0
     }
 
-    # Verify embedding dimensions
-    if {[llength $embedding_list] != $embedding_dim} {
-        puts "⚠️  Warning: Expected $embedding_dim dims, got [llength $embedding_list]"
+    set row_bytes [expr {[string length $slab] / [llength $docs]}]
+    if {$row_bytes != $embedding_dim * 4} {
+        puts "⚠️  Warning: Expected $embedding_dim dims, got [expr {$row_bytes / 4}]"
     }
 
     # ─────────────────────────────────────────────────────────────────
-    # STEP 3: Convert to binary format
+    # STEP 3: Insert one row per document
     # ─────────────────────────────────────────────────────────────────
-    #
-    # Tcl embedding is a list of floats. MySQL stores as BINARY.
-    # The 'f*' format converts list to native-endian floats (4 bytes each).
-    #
-    # Example:
-    #   Input:  {1.0 0.0 -1.0}
-    #   Output: Binary data (12 bytes)
-    #   Size:   [llength $embedding_list] * 4 bytes
-    #
-    set binary_blob [binary format f* $embedding_list]
-
-    if {[string length $binary_blob] != [expr {$embedding_dim * 4}]} {
-        puts "⚠️  Binary size mismatch: expected [expr {$embedding_dim * 4}], got [string length $binary_blob]"
+    set inserted 0
+    set offset 0
+    foreach doc $docs {
+        set blob [string range $slab $offset [expr {$offset + $row_bytes - 1}]]
+        incr offset $row_bytes
+        if {[insert_document $db [dict get $doc categoria] [dict get $doc texto] $blob]} {
+            incr inserted
+        }
     }
 
     # ─────────────────────────────────────────────────────────────────
-    # STEP 4: Escape data for SQL safety
-    # ─────────────────────────────────────────────────────────────────
-    #
-    # mysql::escape handles:
-    # - Quote escaping in text (remove ambiguity)
-    # - Null byte handling in binary data
-    # - Character encoding issues
-    #
-    # IMPORTANT: Always escape before inserting into SQL strings!
-    #
-    set esc_texto [mysql::escape $db $texto]
-    set esc_blob  [mysql::escape $db $binary_blob]
-
-    # ─────────────────────────────────────────────────────────────────
-    # STEP 5: Execute INSERT query
+    # STEP 4: Autotune
     # ─────────────────────────────────────────────────────────────────
     #
-    # Store document with embedding in database
+    # The tuner measures real tokens/sec per window and moves the batch
+    # size and thread count towards the fastest configuration.
     #
-    set sql "INSERT INTO youtube_rag (categoria, contenido, embedding) \
-             VALUES ('$categoria', '$esc_texto', '$esc_blob')"
-
-    if {[catch {mysql::query $db $sql} err]} {
-        puts "❌ Database INSERT failed: $err"
-        return 0
+    if {$tuner ne ""} {
+        set secs [expr {([clock microseconds] - $start) / 1e6}]
+        if {[autotune::record $tuner [llength $docs] $tokens $secs]} {
+            set config [autotune::current $tuner]
+            set batch_size [dict get $config batch]
+            set threads [dict get $config threads]
+            if {$threads != $intra_threads} {
+                # Open first: if it fails the old handle keeps working, and
+                # tuning stops, since the tuner would credit the wrong config
+                if {[catch {open_model $threads} new_handle]} {
+                    puts "⚠️  autotune: cannot open a handle with $threads threads, keeping $intra_threads and stopping: $new_handle"
+                    autotune::destroy $tuner
+                    set tuner ""
+                } else {
+                    embedding::free $handle
+                    set handle $new_handle
+                    set intra_threads $threads
+                }
+            }
+        }
     }
 
-    return 1
+    return $inserted
 }
 
 # ============================================================================
@@ -251,20 +336,25 @@ set documents {
 set ingested_count 0
 set failed_count 0
 
-foreach doc $documents {
-    dict with doc {
-        if {$verbose} {
-            puts "\nProcessing: [string range $texto 0 60]..."
-        }
+# batch_size is re-read on every batch: autotune may change it
+set pending $documents
+while {[llength $pending] > 0} {
+    set batch [lrange $pending 0 [expr {$batch_size - 1}]]
+    set pending [lrange $pending $batch_size end]
 
-        if {[ingest_document $db $categoria $texto]} {
-            incr ingested_count
-            puts "✅ Ingested ($categoria): [string range $texto 0 50]..."
-        } else {
-            incr failed_count
-            puts "❌ Failed to ingest ($categoria)"
-        }
+    if {$verbose} {
+        puts "\nProcessing batch of [llength $batch] documents..."
     }
+
+    set ok [ingest_batch $db $batch]
+    incr ingested_count $ok
+    incr failed_count [expr {[llength $batch] - $ok}]
+    puts "✅ Ingested $ok/[llength $batch] documents"
+}
+
+if {$tuner ne ""} {
+    set best [autotune::best $tuner]
+    puts "📈 Autotune: batch [dict get $best batch], threads [dict get $best threads] ([dict get $best state])"
 }
 
 # ============================================================================
@@ -0,0 +1,288 @@
+#!/usr/bin/env tclsh
+
+#==============================================================================
+# migrate.tcl - Zero-downtime embedding model migration
+#==============================================================================
+#
+# Purpose: Move youtube_rag to a new embedding model without re-ingesting
+#          everything before search can use it.
+#
+# Convention (see schema.sql):
+#   embedding / model_version            - current vector space
+#   embedding_next / model_version_next  - new vector space, filled here
+#
+# Steps:
+#   1. tclsh migrate.tcl prepare   - add the *_next columns (and model_version
+#                                    on tables created before it existed)
+#   2. set migration_* in search.tcl: search reads both spaces and merges
+#      them by rank, so results improve as rows are re-embedded
+#   3. tclsh migrate.tcl run       - throttled background re-embed in PK
+#                                    order; safe to stop and restart
+#   4. tclsh migrate.tcl status    - progress
+#   5. stop ingest.tcl
+#   6. tclsh migrate.tcl cutover   - once nothing is pending, swap the
+#                                    columns by name (metadata-only ALTER)
+#   7. point ingest/search at the new model and restart ingest.tcl
+#
+# Rows inserted while the migration runs (ingest.tcl still writes the old
+# model) are picked up: when `run` reaches the end of the table it starts
+# over for rows still pending, and only exits when none are left.
+#
+# Usage:
+#   tclsh migrate.tcl prepare|run|status|cutover ?-option value ...?
+#
+# Options:
+#   -model file      new model (default: models/e5-base/model.onnx)
+#   -vocab file      new tokenizer.json (default: next to the model)
+#   -version tag     value written to model_version_next (default: e5-base)
+#   -batch n         rows per compute_batch call (default: 32)
+#   -rate n          max rows per second, 0 = unthrottled (default: 50)
+#   -projection file PCA projection for the new model (optional)
+#
+#==============================================================================
+
+package require Tcl 8.6-
+package require tclembedding
+package require tokenizer
+package require mysqltcl
+
+# ============================================================================
+# CONFIGURATION
+# ============================================================================
+
+set script_dir [file dirname [file normalize [info script]]]
+set base_dir   [file join $script_dir ".."]
+
+# MySQL Connection Configuration
+set db_host     "localhost"
+set db_user     "root"
+set db_password ""
+set db_database "rag"
+
+set options [dict create \
+    -model      [file join $base_dir "models" "e5-base" "model.onnx"] \
+    -vocab      "" \
+    -version    "e5-base" \
+    -batch      32 \
+    -rate       50 \
+    -projection "" \
+]
+
+set usage "usage: migrate.tcl prepare|run|status|cutover ?-model file? ?-vocab file? ?-version tag? ?-batch n? ?-rate rows_per_sec? ?-projection file?"
+
+set command [lindex $argv 0]
+if {$command ni {prepare run status cutover} || [llength $argv] % 2 == 0} {
+    puts stderr $usage
+    exit 1
+}
+foreach {key value} [lrange $argv 1 end] {
+    if {![dict exists $options $key]} {
+        puts stderr $usage
+        exit 1
+    }
+    dict set options $key $value
+}
+if {[dict get $options -vocab] eq ""} {
+    dict set options -vocab [file join [file dirname [dict get $options -model]] "tokenizer.json"]
+}
+
+if {[catch {
+    set db [mysql::connect \
+        -host $db_host \
+        -user $db_user \
+        -password $db_password \
+        -db $db_database \
+    ]
+} err]} {
+    puts "❌ MySQL Connection Failed: $err"
+    exit 1
+}
+
+set esc_version [mysql::escape $db [dict get $options -version]]
+
+# Rows whose new-space vector is missing or from another target version
+set pending_filter "(model_version_next IS NULL OR model_version_next <> '$esc_version')"
+
+# ============================================================================
+# HELPERS
+# ============================================================================
+
+proc has_column {db column} {
+    set n [mysql::sel $db "SELECT COUNT(*) FROM information_schema.COLUMNS
+                           WHERE TABLE_SCHEMA = DATABASE()
+                             AND TABLE_NAME = 'youtube_rag'
+                             AND COLUMN_NAME = '$column'" -flatlist]
+    return [expr {[lindex $n 0] > 0}]
+}
+
+proc pending_count {db} {
+    global pending_filter
+    return [lindex [mysql::sel $db "SELECT COUNT(*) FROM youtube_rag WHERE $pending_filter" -flatlist] 0]
+}
+
+# ============================================================================
+# COMMANDS
+# ============================================================================
+
+#
+# prepare - Add the migration columns (idempotent)
+#
+proc migrate_prepare {db} {
+    set columns {
+        model_version      "VARCHAR(64) NOT NULL DEFAULT 'e5-small'"
+        embedding_next     "VARBINARY(4096) NULL"
+        model_version_next "VARCHAR(64) NULL"
+    }
+    foreach {column type} $columns {
+        if {[has_column $db $column]} {
+            puts "✓ $column already present"
+            continue
+        }
+        mysql::exec $db "ALTER TABLE youtube_rag ADD COLUMN $column $type"
+        puts "✓ Added $column"
+    }
+}
+
+#
+# run - Re-embed pending rows in primary key order, batched and throttled
+#
+# Each batch is one SELECT (id > cursor ORDER BY id LIMIT batch), one
+# compute_batch call and one UPDATE per row. The cursor only moves
+# forward, so a restart continues where the pending rows are.
+#
+proc migrate_run {db} {
+    global pending_filter esc_version options
+    set model_path [dict get $options -model]
+    set version    [dict get $options -version]
+    set batch      [dict get $options -batch]
+    set rate       [dict get $options -rate]
+
+    tokenizer::load_vocab [dict get $options -vocab]
+    set init_opts [list]
+    if {[dict get $options -projection] ne ""} {
+        lappend init_opts -projection [dict get $options -projection]
+    }
+    set handle [embedding::init_raw $model_path {*}$init_opts]
+
+    set total [pending_count $db]
+    puts "🔁 Re-embedding $total rows with $model_path (batch $batch, rate $rate rows/s)"
+
+    set cursor 0
+    set done 0
+    set started [clock milliseconds]
+    while 1 {
+        set batch_start [clock milliseconds]
+        set rows [mysql::sel $db "SELECT id, contenido FROM youtube_rag
+                                  WHERE id > $cursor AND $pending_filter
+                                  ORDER BY id LIMIT $batch" -list]
+        if {[llength $rows] == 0} {
+            # End of table: start over for rows inserted behind the cursor
+            if {$cursor == 0} break
+            set cursor 0
+            continue
+        }
+
+        set token_lists [list]
+        foreach row $rows {
+            lappend token_lists [tokenizer::tokenize "passage: [lindex $row 1]"]
+        }
+        set slab [embedding::compute_batch $handle $token_lists -format binary]
+        set row_bytes [expr {[string length $slab] / [llength $rows]}]
+
+        set offset 0
+        foreach row $rows {
+            set blob [string range $slab $offset [expr {$offset + $row_bytes - 1}]]
+            incr offset $row_bytes
+            mysql::exec $db "UPDATE youtube_rag
+                             SET embedding_next = '[mysql::escape $db $blob]',
+                                 model_version_next = '$esc_version'
+                             WHERE id = [lindex $row 0]"
+        }
+        set cursor [lindex $rows end 0]
+        incr done [llength $rows]
+
+        if {$done % ($batch * 20) < $batch} {
+            set secs [expr {max(1, [clock milliseconds] - $started) / 1000.0}]
+            puts [format "   %d rows (id %d), %.1f rows/s" $done $cursor [expr {$done / $secs}]]
+        }
+
+        # Throttle: a batch of n rows takes at least n / rate seconds
+        if {$rate > 0} {
+            set budget_ms [expr {int(1000.0 * [llength $rows] / $rate)}]
+            set wait [expr {$budget_ms - ([clock milliseconds] - $batch_start)}]
+            if {$wait > 0} {
+                after $wait
+            }
+        }
+    }
+
+    embedding::free $handle
+    puts "✓ Re-embedded $done rows; nothing pending for $version"
+}
+
+#
+# status - Progress of the migration
+#
+proc migrate_status {db} {
+    global options
+    set total [lindex [mysql::sel $db "SELECT COUNT(*) FROM youtube_rag" -flatlist] 0]
+    set pending [pending_count $db]
+    set migrated [expr {$total - $pending}]
+    set pct [expr {$total > 0 ? 100.0 * $migrated / $total : 100.0}]
+    puts [format "%s: %d / %d rows re-embedded (%.1f%%), %d pending" [dict get $options -version] $migrated $total $pct $pending]
+}
+
+#
+# cutover - Make the new space the primary one
+#
+# Column renames are metadata-only in MySQL 8, so this is instant. The old
+# space stays as embedding_prev / model_version_prev until dropped by hand.
+#
+# ingest.tcl must be stopped first: it writes the old model into
+# `embedding`, which after the rename is the new space. The pending check
+# and the rename run under one table write lock, so nothing can land
+# between them; an INSERT waiting on the lock would still go in after the
+# rename with an old-model vector, hence the stop.
+#
+proc migrate_cutover {db} {
+    set pending [pending_count $db]
+    if {$pending > 0} {
+        puts "❌ $pending rows still pending; run `migrate.tcl run` first"
+        exit 1
+    }
+    mysql::exec $db "LOCK TABLES youtube_rag WRITE"
+    set failed [catch {
+        set pending [pending_count $db]
+        if {$pending == 0} {
+            mysql::exec $db "ALTER TABLE youtube_rag
+                             RENAME COLUMN embedding TO embedding_prev,
+                             RENAME COLUMN model_version TO model_version_prev,
+                             RENAME COLUMN embedding_next TO embedding,
+                             RENAME COLUMN model_version_next TO model_version"
+        }
+    } err]
+    mysql::exec $db "UNLOCK TABLES"
+    if {$failed} {
+        error $err
+    }
+    if {$pending > 0} {
+        puts "❌ $pending rows inserted since the check; stop ingest.tcl, run `migrate.tcl run`, then cut over"
+        exit 1
+    }
+    puts "✓ Cutover done. Point ingest.tcl/search.tcl at the new model and clear migration_*,"
+    puts "  then restart ingest.tcl."
+    puts "  Drop the old space when no longer needed:"
+    puts "  ALTER TABLE youtube_rag DROP COLUMN embedding_prev, DROP COLUMN model_version_prev;"
+}
+
+# ============================================================================
+# MAIN
+# ============================================================================
+
+if {[catch {migrate_$command $db} err]} {
+    puts "❌ $command failed: $err"
+    mysql::close $db
+    exit 1
+}
+
+mysql::close $db
@@ -0,0 +1,117 @@
+/*
+ * pgo_bench.c - Offline workload for the cosine_similarity UDF
+ *
+ * Drives the UDF entry points the way mysqld does during a full-table
+ * scan (init -> one call per row -> deinit) over synthetic float32 blobs.
+ * It is the training run of `make pgo` and, built against the plain and
+ * the PGO objects, the benchmark that reports the speedup.
+ *
+ * Output is one "metric value" pair per line, e.g.:
+ *   udf_scan_384_rows_per_sec 41234567
+ *
+ * USAGE:
+ *   ./pgo_bench [rows] [statements]
+ */
+
+#include <mysql.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef my_bool
+typedef char my_bool;
+#endif
+
+my_bool cosine_similarity_init(UDF_INIT *initid, UDF_ARGS *args, char *message);
+double cosine_similarity(UDF_INIT *initid, UDF_ARGS *args, char *is_null, char *error);
+void cosine_similarity_deinit(UDF_INIT *initid);
+
+/* =========================
+   Synthetic data
+   ========================= */
+
+static unsigned long long rng_state = 0x9E3779B97F4A7C15ULL;
+
+static float next_float(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (float)((rng_state >> 40) & 0xFFFFFF) / (float)0x800000 - 1.0f;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* =========================
+   One "SELECT ... ORDER BY score" statement
+   ========================= */
+
+static double scan(const float *rows, int nrows, int dim, const float *query) {
+    UDF_INIT initid;
+    UDF_ARGS args;
+    enum Item_result types[2] = {STRING_RESULT, STRING_RESULT};
+    char *values[2];
+    unsigned long lengths[2] = {dim * sizeof(float), dim * sizeof(float)};
+    char message[512];
+    double checksum = 0.0;
+
+    memset(&initid, 0, sizeof(initid));
+    memset(&args, 0, sizeof(args));
+    args.arg_count = 2;
+    args.arg_type = types;
+    args.args = values;
+    args.lengths = lengths;
+
+    /* The row column is not constant: mysqld passes NULL for it at init */
+    values[0] = NULL;
+    values[1] = (char *)query;
+    if (cosine_similarity_init(&initid, &args, message)) {
+        fprintf(stderr, "cosine_similarity_init: %s\n", message);
+        exit(1);
+    }
+
+    for (int r = 0; r < nrows; r++) {
+        char is_null = 0, error = 0;
+        /* Every 64th row is NULL, as in a sparsely populated column */
+        values[0] = (r % 64 == 63) ? NULL : (char *)(rows + (size_t)r * dim);
+        checksum += cosine_similarity(&initid, &args, &is_null, &error);
+    }
+
+    cosine_similarity_deinit(&initid);
+    return checksum;
+}
+
+int main(int argc, char **argv) {
+    static const int dims[] = {384, 768, 1024};
+    int nrows = (argc > 1) ? atoi(argv[1]) : 20000;
+    int statements = (argc > 2) ? atoi(argv[2]) : 50;
+    double checksum = 0.0;
+
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        int dim = dims[d];
+        float *rows = malloc((size_t)nrows * dim * sizeof(float));
+        float *query = malloc(dim * sizeof(float));
+        if (!rows || !query) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        for (size_t i = 0; i < (size_t)nrows * dim; i++) rows[i] = next_float();
+        for (int i = 0; i < dim; i++) query[i] = next_float();
+
+        double t0 = now_sec();
+        for (int s = 0; s < statements; s++) checksum += scan(rows, nrows, dim, query);
+        double elapsed = now_sec() - t0;
+
+        printf("udf_scan_%d_rows_per_sec %.0f\n", dim, (double)nrows * statements / elapsed);
+        free(rows);
+        free(query);
+    }
+
+    /* Keeps the scans from being optimized away */
+    fprintf(stderr, "checksum %.6f\n", checksum);
+    return 0;
+}
@@ -0,0 +1,223 @@
+#!/usr/bin/env tclsh
+
+#==============================================================================
+# pgo_workload.tcl - Offline training workload for the tclembedding extension
+#==============================================================================
+#
+# Purpose: Exercise the extension's hot paths without a database. Used by
+#          `make pgo` as the profiling run and as the benchmark that
+#          compares the plain and the PGO builds.
+#
+# Two parts:
+#   - store: synthetic vectors through embedding::store (every layout and
+#     plan), embedding::refine and embedding::pca_fit. Needs no model, so
+#     it always runs.
+#   - compute: token ingest, tensor build, inference, mean pooling and
+#     result marshaling. Needs a model, which is not bundled: it uses
+#     models/e5-small unless TCLEMBEDDING_MODEL points elsewhere, and is
+#     skipped without one.
+#
+# Output is one "metric value" pair per line, e.g.:
+#   ext_store_rows_scan_384_per_sec 2150
+#   ext_compute_per_sec 812
+#
+# Usage:
+#   tclsh pgo_workload.tcl path/to/tclembedding.so ?iterations?
+#
+#==============================================================================
+
+package require Tcl 8.6-
+
+set script_dir [file dirname [file normalize [info script]]]
+set base_dir   [file join $script_dir ".."]
+
+if {[llength $argv] < 1} {
+    puts stderr "usage: pgo_workload.tcl path/to/tclembedding.so ?iterations?"
+    exit 1
+}
+set lib_path   [file normalize [lindex $argv 0]]
+set iterations [expr {[llength $argv] > 1 ? [lindex $argv 1] : 200}]
+
+if {[info exists env(TCLEMBEDDING_MODEL)]} {
+    set model_onnx $env(TCLEMBEDDING_MODEL)
+} else {
+    set model_onnx [file join $base_dir "models" "e5-small" "model.onnx"]
+}
+set model_vocab [file join [file dirname $model_onnx] "tokenizer.json"]
+
+load $lib_path Tclembedding
+
+# ============================================================================
+# STORE (no model)
+# ============================================================================
+
+# n vectors of dim random floats, as store add and pca_fit take them
+proc random_vectors {n dim} {
+    set values {}
+    for {set i 0} {$i < $n * $dim} {incr i} {
+        lappend values [expr {rand() * 2.0 - 1.0}]
+    }
+    return [binary format f* $values]
+}
+
+proc random_query {dim} {
+    set q {}
+    for {set i 0} {$i < $dim} {incr i} {
+        lappend q [expr {rand() * 2.0 - 1.0}]
+    }
+    return $q
+}
+
+# Runs script once per query and prints searches per second as metric
+proc time_queries {metric queries script} {
+    set start [clock microseconds]
+    foreach q $queries {
+        apply [list {q} $script] $q
+    }
+    set elapsed [expr {max(1, [clock microseconds] - $start)}]
+    puts [format "%s %.0f" $metric [expr {[llength $queries] * 1e6 / $elapsed}]]
+}
+
+expr {srand(7)}
+
+set store_rows 8000
+set nlist 64
+set categories {transcripcion comentario metadata}
+set weights {transcripcion 0.05 comentario -0.02}
+
+# 384 takes the fixed-dimension kernels, 256 (a PCA output) the generic ones
+foreach dim {384 256} {
+    set vectors [random_vectors $store_rows $dim]
+    set ids {}
+    set attrs {}
+    set cats {}
+    for {set i 0} {$i < $store_rows} {incr i} {
+        lappend ids $i
+        lappend attrs [expr {$i % 365}]
+        lappend cats [lindex $categories [expr {$i % 3}]]
+    }
+    set queries {}
+    for {set i 0} {$i < $iterations} {incr i} {
+        lappend queries [random_query $dim]
+    }
+
+    foreach layout {rows blocked} {
+        set store [embedding::store create $dim -layout $layout]
+        embedding::store add $store $ids $vectors -attrs $attrs -categories $cats
+        embedding::store index $store $nlist
+        embedding::store reorder $store
+
+        time_queries ext_store_${layout}_scan_${dim}_per_sec $queries {
+            embedding::store search $::store $q 10 -plan scan
+        }
+        time_queries ext_store_${layout}_boosted_${dim}_per_sec $queries {
+            embedding::store search $::store $q 10 -plan scan -decay 0.01 -weights $::weights
+        }
+        time_queries ext_store_${layout}_subset_${dim}_per_sec $queries {
+            embedding::store search $::store $q 10 -plan subset -categories comentario
+        }
+        time_queries ext_store_${layout}_ivf_${dim}_per_sec $queries {
+            embedding::store search $::store $q 10 -plan ivf -nprobe 4
+        }
+        time_queries ext_store_${layout}_refine_${dim}_per_sec $queries {
+            embedding::store refine $::store $q 10
+        }
+        embedding::store free $store
+    }
+
+    # Rocchio over blobs, the shape search.tcl passes after a SQL round
+    set row_bytes [expr {$dim * 4}]
+    set hits {}
+    for {set i 0} {$i < 5} {incr i} {
+        lappend hits [string range $vectors [expr {$i * $row_bytes}] [expr {($i + 1) * $row_bytes - 1}]]
+    }
+    time_queries ext_refine_${dim}_per_sec $queries {
+        embedding::refine [binary format f* $q] $::hits -negatives [lrange $::hits 3 4]
+    }
+}
+
+# PCA training: covariance accumulation and the tridiagonal eigensolver
+set pca_file [file join [file dirname $lib_path] "pgo-pca.bin"]
+set pca_samples 2000
+set samples [string range $vectors 0 [expr {$pca_samples * 256 * 4 - 1}]]
+set start [clock microseconds]
+embedding::pca_fit $samples 256 64 $pca_file
+set elapsed [expr {max(1, [clock microseconds] - $start)}]
+puts [format "ext_pca_fit_samples_per_sec %.0f" [expr {$pca_samples * 1e6 / $elapsed}]]
+file delete $pca_file
+
+# ============================================================================
+# COMPUTE (needs a model)
+# ============================================================================
+
+if {![file exists $model_onnx]} {
+    puts stderr "pgo_workload: no model at $model_onnx, skipping the compute workload"
+    exit 0
+}
+
+# ============================================================================
+# CORPUS
+# ============================================================================
+
+# Mix of short comments, metadata lines and long transcript chunks, so the
+# profile sees the same sequence-length spread as youtube_rag.
+set corpus {
+    "La edición del minuto 4:20 es espectacular."
+    "Excelente video, saludos desde Lima"
+    "Locación: Kioto, Templo Kiyomizu-dera. Clima: Lluvioso. Fecha: 2024-12-21. Duración: 12 minutos."
+    "En este video visitamos el mercado de Tsukiji en Tokio para probar el sushi más fresco de la ciudad. El mercado es una institución icónica con más de 80 años de historia y cada mañana recibe toneladas de pescado."
+    "¿Qué comieron en Tokio?"
+    "Templos antiguos"
+}
+
+# Without a vocabulary (or tcllib's json) fall back to synthetic ids with
+# the same lengths the real tokenizer would roughly produce.
+set use_tokenizer 0
+if {[file exists $model_vocab] && ![catch {
+    source [file join $base_dir "lib" "tokenizer.tcl"]
+    tokenizer::load_vocab $model_vocab
+}]} {
+    set use_tokenizer 1
+}
+
+proc token_ids {text} {
+    global use_tokenizer
+    if {$use_tokenizer} {
+        return [tokenizer::tokenize "passage: $text"]
+    }
+    set ids [list 0]
+    foreach word [split $text] {
+        lappend ids [expr {1000 + ([string length $word] * 97) % 20000}]
+    }
+    lappend ids 2
+    return $ids
+}
+
+set token_lists [list]
+foreach text $corpus {
+    lappend token_lists [token_ids $text]
+}
+
+# ============================================================================
+# RUN
+# ============================================================================
+
+set handle [embedding::init_raw $model_onnx]
+
+# Warm-up so arena growth is not in the measurement
+foreach tokens $token_lists {
+    embedding::compute $handle $tokens
+}
+
+set start [clock microseconds]
+for {set i 0} {$i < $iterations} {incr i} {
+    foreach tokens $token_lists {
+        embedding::compute $handle $tokens
+    }
+}
+set elapsed [expr {max(1, [clock microseconds] - $start)}]
+set calls [expr {$iterations * [llength $token_lists]}]
+
+puts [format "ext_compute_per_sec %.0f" [expr {$calls * 1e6 / $elapsed}]]
+
+embedding::free $handle
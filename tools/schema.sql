@@ -4,5 +4,16 @@ CREATE TABLE IF NOT EXISTS youtube_rag (
     categoria ENUM('transcripcion', 'metadatos', 'comentario'),
     contenido TEXT,
     embedding BINARY(1536), -- 384 floats * 4 bytes
+    model_version VARCHAR(64) NOT NULL DEFAULT 'e5-small', -- Modelo que generó `embedding`
     created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
 ) ENGINE=InnoDB;
+
+-- Migración de modelo (tools/migrate.tcl): mientras dura, el modelo nuevo
+-- escribe en columnas paralelas y search.tcl lee ambos espacios.
+-- Tablas creadas antes de model_version:
+--   ALTER TABLE youtube_rag ADD COLUMN model_version VARCHAR(64) NOT NULL DEFAULT 'e5-small';
+-- `migrate.tcl prepare` agrega (y model_version si falta):
+--   embedding_next     VARBINARY(4096) NULL  -- vector del modelo nuevo
+--   model_version_next VARCHAR(64) NULL      -- versión de embedding_next
+-- `migrate.tcl cutover` las renombra a embedding / model_version y deja las
+-- anteriores como embedding_prev / model_version_prev.
@@ -28,7 +28,7 @@
 #
 #==============================================================================
 
-package require Tcl 8.6
+package require Tcl 8.6-
 package require tclembedding
 package require tokenizer
 package require mysqltcl
@@ -45,6 +45,19 @@ set base_dir   [file join $script_dir ".."]
 set model_onnx  [file join $base_dir "models" "e5-small" "model.onnx"]
 set model_vocab [file join $base_dir "models" "e5-small" "tokenizer.json"]
 
+# Optional PCA projection from embedding::pca_fit ("" = full model output).
+# Ingest and search must use the same file; set embedding_dim to its output.
+set model_projection ""
+set model_layers 0             ;# >0 = early-exit tier (rows ingested with the same layer)
+
+# Model migration (tools/migrate.tcl). While migration_model is set, every
+# search also queries the new space (embedding_next, rows already
+# re-embedded as migration_version) and merges both by rank. Clear these
+# after `migrate.tcl cutover` and point model_onnx at the new model.
+set migration_model   ""       ;# e.g. models/e5-base/model.onnx
+set migration_vocab   ""       ;# e.g. models/e5-base/tokenizer.json
+set migration_version ""       ;# e.g. e5-base
+
 # MySQL Connection Configuration
 set db_host     "localhost"
 set db_user     "root"
@@ -57,6 +70,19 @@ set default_limit 3            ;# Default results to return
 set min_score_threshold 0.0    ;# Minimum similarity score
 set verbose 1                  ;# Print progress messages
 
+# Score boosts (0 / empty = plain cosine similarity). With either one set the
+# query uses cosine_similarity_boost(), so ORDER BY ... LIMIT already returns
+# the boosted top-K and no over-fetching or re-sorting is needed here.
+set recency_decay 0.0          ;# Per day of age: sim * exp(-decay * days)
+set category_weights {}        ;# e.g. {transcripcion 0.05 comentario -0.02}
+
+# Candidates from the vector_index plugin (0 = full scan). With N > 0 only the
+# N ids returned by vector_knn() are scored, so N should be well above the
+# limit; needs src/vector_index.c loaded and tools/vector_index.sql applied.
+# Only the `embedding` column is indexed: a migration's second space still scans.
+set vector_index_candidates 0  ;# e.g. 100
+set vector_index_table "rag.youtube_rag"
+
 # ============================================================================
 # INITIALIZATION AND VALIDATION
 # ============================================================================
@@ -98,7 +124,32 @@ puts "✓ Connected to MySQL"
 # Initialize embedding model
 if {[catch {
     tokenizer::load_vocab $model_vocab
-    set handle [embedding::init_raw $model_onnx]
+    set init_opts [list -layers $model_layers]
+    if {$model_projection ne ""} {
+        lappend init_opts -projection $model_projection
+    }
+    set handle [embedding::init_raw $model_onnx {*}$init_opts]
+    tokenizer::save_vocab current
+
+    # ingest.tcl tags early-exit rows as <version>@L<layer>: each tier only
+    # scores its own rows
+    set layers [dict get [embedding::reload $handle] layers]
+    if {$layers > 0} {
+        set tier "model_version LIKE '%@L$layers'"
+    } else {
+        set tier "model_version NOT LIKE '%@L%'"
+    }
+
+    # Vector spaces searched by semantic_search
+    set spaces [list [dict create handle $handle vocab current column embedding where $tier]]
+    if {$migration_model ne ""} {
+        tokenizer::load_vocab $migration_vocab
+        tokenizer::save_vocab next
+        set handle_next [embedding::init_raw $migration_model]
+        lappend spaces [dict create handle $handle_next vocab next column embedding_next \
+            where "model_version_next = '[mysql::escape $db $migration_version]'"]
+        puts "✓ Migration model loaded (dual-read with $migration_version)"
+    }
 } err]} {
     puts "❌ Failed to initialize embedding model: $err"
     mysql::close $db
@@ -122,20 +173,17 @@ if {[catch {
 # ============================================================================
 
 #
-# semantic_search - Find similar documents to a query
+# space_search - Top-K rows of one vector space
 #
 # Arguments:
 #   db        - MySQL database handle
+#   space     - Dict: handle (embedding handle), vocab (tokenizer vocab name),
+#               column (embedding column), where (extra SQL filter or "")
 #   query     - Search query string (natural language)
-#   limit     - Maximum number of results to return (default: 3)
+#   limit     - Maximum number of rows
 #
 # Returns:
-#   List of results, each containing:
-#   - id: Document ID
-#   - titulo: Document title/preview
-#   - categoria: Document category
-#   - score: Similarity score (0.0 to 1.0)
-#   - contenido: Document content
+#   List of dicts {id categoria contenido score}, best first
 #
 # Process:
 #   1. Prepend "query: " prefix (required for E5 model)
@@ -145,8 +193,9 @@ if {[catch {
 #   5. ORDER BY similarity score DESC
 #   6. Return top-K results
 #
-proc semantic_search {db query {limit 3}} {
-    global handle embedding_dim verbose
+proc space_search {db space query limit} {
+    global embedding_dim recency_decay category_weights
+    global vector_index_candidates vector_index_table
 
     # ─────────────────────────────────────────────────────────────────
     # STEP 1: Prepare query with E5 prefix
@@ -158,26 +207,19 @@ proc semantic_search {db query {limit 3}} {
     #
     set query_prepared "query: $query"
 
-    if {$verbose} {
-        puts "🔍 Query: $query"
-    }
-
     # ─────────────────────────────────────────────────────────────────
     # STEP 2: Generate query embedding
     # ─────────────────────────────────────────────────────────────────
     #
     # tokenizer::tokenize + embedding::compute returns list of floats
-    # representing the semantic meaning of the query
+    # representing the semantic meaning of the query. Each space has its
+    # own model and vocabulary.
     #
-    if {[catch {
-        set tokens [tokenizer::tokenize $query_prepared]
-        set query_embedding [embedding::compute $handle $tokens]
-    } err]} {
-        puts "❌ Embedding generation failed: $err"
-        return [list]
-    }
+    tokenizer::use_vocab [dict get $space vocab]
+    set tokens [tokenizer::tokenize $query_prepared]
+    set query_embedding [embedding::compute [dict get $space handle] $tokens]
 
-    if {[llength $query_embedding] != $embedding_dim} {
+    if {[dict get $space column] eq "embedding" && [llength $query_embedding] != $embedding_dim} {
         puts "⚠️  Warning: Unexpected embedding dimensions"
     }
 
@@ -213,51 +255,132 @@ proc semantic_search {db query {limit 3}} {
     # The cosine_similarity() UDF is implemented in C for performance.
     # It calculates: dot(v1,v2) / (magnitude(v1) * magnitude(v2))
     #
-    set sql "SELECT contenido, categoria,
-                    cosine_similarity(embedding, '$esc_query') AS score
+    # With boosts, cosine_similarity_boost() folds the recency decay and
+    # the category weight into the score inside the UDF call.
+    #
+    set column [dict get $space column]
+    set score_expr "cosine_similarity($column, '$esc_query')"
+    if {$recency_decay != 0.0 || [dict size $category_weights] > 0} {
+        set weights [list]
+        dict for {name weight} $category_weights {
+            lappend weights "$name=[expr {double($weight)}]"
+        }
+        set esc_weights [mysql::escape $db [join $weights ,]]
+        set score_expr "cosine_similarity_boost($column, '$esc_query',
+                            TIMESTAMPDIFF(DAY, created_at, NOW()),
+                            [expr {double($recency_decay)}],
+                            categoria, '$esc_weights')"
+    }
+
+    # With the vector_index plugin, vector_knn() narrows the rows to its
+    # approximate top-N; the score above is still exact, so ORDER BY and
+    # the boosts work as without it.
+    set conditions [list]
+    if {[dict get $space where] ne ""} {
+        lappend conditions [dict get $space where]
+    }
+    if {$vector_index_candidates > 0 && $column eq "embedding"} {
+        set esc_table [mysql::escape $db $vector_index_table]
+        lappend conditions "id IN (SELECT k.id FROM JSON_TABLE(
+                                vector_knn('$esc_table', '$esc_query', [expr {int($vector_index_candidates)}]),
+                                '\$\[*\]' COLUMNS (id BIGINT PATH '\$')) AS k)"
+    }
+    set where ""
+    if {[llength $conditions] > 0} {
+        set where "WHERE [join $conditions { AND }]"
+    }
+
+    set sql "SELECT id, contenido, categoria,
+                    $score_expr AS score
              FROM youtube_rag
+             $where
              ORDER BY score DESC
              LIMIT $limit"
 
     # ─────────────────────────────────────────────────────────────────
     # STEP 6: Execute query and collect results
     # ─────────────────────────────────────────────────────────────────
-    #
-    # mysql::sel executes SELECT
-    # mysql::map iterates through results with variable binding
-    #
     set results [list]
-    set result_count 0
-
-    if {[catch {
-        mysql::sel $db $sql
+    foreach row [mysql::sel $db $sql -list] {
+        lassign $row id contenido categoria score
+        lappend results [dict create id $id categoria $categoria contenido $contenido score $score]
+    }
+    return $results
+}
 
-        mysql::map $db {contenido categoria score} {
-            incr result_count
+#
+# merge_by_rank - Reciprocal rank fusion of several result lists
+#
+# Scores from two different models are not comparable, ranks are: each
+# row gets sum(1 / (60 + rank)) over the lists it appears in. The
+# returned dicts keep the row's best raw score and gain a fused score.
+#
+proc merge_by_rank {lists limit} {
+    set fused [dict create]
+    set rows [dict create]
+    foreach results $lists {
+        set rank 0
+        foreach row $results {
+            incr rank
+            set id [dict get $row id]
+            set previous [expr {[dict exists $fused $id] ? [dict get $fused $id] : 0.0}]
+            dict set fused $id [expr {$previous + 1.0 / (60 + $rank)}]
+            if {![dict exists $rows $id] || [dict get $row score] > [dict get $rows $id score]} {
+                dict set rows $id $row
+            }
+        }
+    }
 
-            # Format score to 4 decimal places
-            set score_fmt [format "%.4f" $score]
+    set order [lsort -real -decreasing -stride 2 -index 1 [dict get $fused]]
+    set merged [list]
+    foreach {id fused_score} [lrange $order 0 [expr {2 * $limit - 1}]] {
+        set row [dict get $rows $id]
+        dict set row fused $fused_score
+        lappend merged $row
+    }
+    return $merged
+}
 
-            # Display result
-            set content_preview [string range $contenido 0 80]
-            puts "   #$result_count \[$score_fmt\] ($categoria): $content_preview..."
+#
+# semantic_search - Find similar documents to a query
+#
+# Arguments:
+#   db        - MySQL database handle
+#   query     - Search query string (natural language)
+#   limit     - Maximum number of results to return (default: 3)
+#
+# Returns:
+#   List of results, each containing:
+#   - rank: Position in the result list
+#   - id: Document ID
+#   - categoria: Document category
+#   - score: Similarity score (0.0 to 1.0)
+#   - contenido: Document content
+#
+# During a model migration both vector spaces are searched (the new one
+# only covers rows already re-embedded) and merged by rank, so search
+# keeps working while tools/migrate.tcl runs.
+#
+proc semantic_search {db query {limit 3}} {
+    global verbose spaces
 
-            # Store result
-            lappend results [dict create \
-                rank $result_count \
-                categoria $categoria \
-                score $score \
-                contenido $contenido \
-            ]
-        }
+    if {$verbose} {
+        puts "🔍 Query: $query"
+    }
 
-        # Handle no results
-        if {$result_count == 0} {
-            puts "   (No results found)"
+    if {[catch {
+        if {[llength $spaces] == 1} {
+            set results [space_search $db [lindex $spaces 0] $query $limit]
+        } else {
+            # Over-fetch per space so rows ranked high in only one survive
+            set lists [list]
+            foreach space $spaces {
+                lappend lists [space_search $db $space $query [expr {2 * $limit}]]
+            }
+            set results [lrange [merge_by_rank $lists $limit] 0 [expr {$limit - 1}]]
         }
-
     } err]} {
-        puts "❌ Search SQL error: $err"
+        puts "❌ Search failed: $err"
         puts ""
         puts "Troubleshooting:"
         puts "1. Check if cosine_similarity UDF is registered:"
@@ -273,7 +396,22 @@ proc semantic_search {db query {limit 3}} {
         return [list]
     }
 
-    return $results
+    set ranked [list]
+    set rank 0
+    foreach result $results {
+        incr rank
+        set score_fmt [format "%.4f" [dict get $result score]]
+        set content_preview [string range [dict get $result contenido] 0 80]
+        puts "   #$rank \[$score_fmt\] ([dict get $result categoria]): $content_preview..."
+        lappend ranked [dict set result rank $rank]
+    }
+
+    # Handle no results
+    if {$rank == 0} {
+        puts "   (No results found)"
+    }
+
+    return $ranked
 }
 
 # ============================================================================
@@ -334,6 +472,9 @@ if {[catch {mysql::close $db}]} {
 
 # Clean up embedding model
 catch {embedding::free $handle}
+if {[info exists handle_next]} {
+    catch {embedding::free $handle_next}
+}
 
 puts "✓ Search complete\n"
 
@@ -0,0 +1,58 @@
+-- Índice vectorial en memoria dentro de mysqld (src/vector_index.c, `make plugin`)
+--
+-- my.cnf (el plugin carga la tabla al arrancar, en segundo plano):
+--   [mysqld]
+--   plugin-load-add     = vector_index.so
+--   vector_index_tables = rag.youtube_rag
+--   # opcionales: vector_index_column (embedding), vector_index_id_column (id),
+--   #             vector_index_user (root), vector_index_nlist, vector_index_nprobe
+-- O en caliente (vector_index_tables es de sólo lectura: ponerlo en my.cnf antes):
+--   INSTALL PLUGIN vector_index SONAME 'vector_index.so';
+
+CREATE FUNCTION vector_knn RETURNS STRING SONAME 'vector_index.so';
+CREATE FUNCTION vector_index_insert RETURNS INTEGER SONAME 'vector_index.so';
+CREATE FUNCTION vector_index_delete RETURNS INTEGER SONAME 'vector_index.so';
+CREATE FUNCTION vector_index_reload RETURNS INTEGER SONAME 'vector_index.so';
+
+-- Mantener el índice al día. No es transaccional: un INSERT revertido queda
+-- en el índice hasta el próximo vector_index_reload() (los candidatos se
+-- vuelven a filtrar con el WHERE id IN (...), así que sólo cuesta recall).
+DELIMITER //
+CREATE TRIGGER youtube_rag_vi_insert AFTER INSERT ON youtube_rag FOR EACH ROW
+BEGIN
+    IF NEW.embedding IS NOT NULL THEN
+        DO vector_index_insert('rag.youtube_rag', NEW.id, NEW.embedding);
+    END IF;
+END//
+
+CREATE TRIGGER youtube_rag_vi_update AFTER UPDATE ON youtube_rag FOR EACH ROW
+BEGIN
+    IF NEW.embedding IS NULL THEN
+        DO vector_index_delete('rag.youtube_rag', OLD.id);
+    ELSEIF NOT (OLD.embedding <=> NEW.embedding) OR OLD.id <> NEW.id THEN
+        IF OLD.id <> NEW.id THEN
+            DO vector_index_delete('rag.youtube_rag', OLD.id);
+        END IF;
+        DO vector_index_insert('rag.youtube_rag', NEW.id, NEW.embedding);
+    END IF;
+END//
+
+CREATE TRIGGER youtube_rag_vi_delete AFTER DELETE ON youtube_rag FOR EACH ROW
+BEGIN
+    DO vector_index_delete('rag.youtube_rag', OLD.id);
+END//
+DELIMITER ;
+
+-- Búsqueda: vector_knn() devuelve los ids como arreglo JSON; JSON_TABLE los
+-- convierte en filas para el IN, y cosine_similarity() da el score exacto.
+-- SET @q = <embedding de la consulta, BINARY float32>;
+-- SELECT id, contenido, cosine_similarity(embedding, @q) AS score
+-- FROM youtube_rag
+-- WHERE id IN (SELECT k.id FROM JSON_TABLE(vector_knn('rag.youtube_rag', @q, 50),
+--                                          '$[*]' COLUMNS (id BIGINT PATH '$')) AS k)
+-- ORDER BY score DESC
+-- LIMIT 5;
+
+-- Estado:
+-- SHOW GLOBAL STATUS LIKE 'vector_index%';
+-- SELECT vector_index_reload('rag.youtube_rag');  -- reconstruye sin cortar búsquedas
@@ -0,0 +1,572 @@
+/*
+ * verify_embeddings.c - Integrity scan of the embeddings stored in MySQL
+ *
+ * Streams every (id, embedding) row of a table with mysql_use_result (rows
+ * are read as the server sends them, never buffered whole on the client)
+ * and checks them in batches on a pool of worker threads while the next
+ * batch is being read:
+ *
+ * - NULL blob
+ * - byte length not a multiple of 4, or a dimension other than the expected
+ * - NaN / Inf components
+ * - zero vector, or L2 norm further than the tolerance from 1.0
+ * - exact duplicates (64-bit hash of the blob)
+ *
+ * Each of these silently skews cosine_similarity() results: NULL and bad
+ * lengths drop rows, NaN poisons the score, unnormalized vectors rank
+ * differently under a dot product, duplicates crowd out the top-k.
+ *
+ * Output: one "id<TAB>problem<TAB>detail" line per problem on stdout and a
+ * summary (rows, MB/s, counts per problem) on stderr. Exit status is 0 when
+ * the table is clean, 2 when problems were found and 1 on errors.
+ *
+ * Connection settings come from the [client] group of ~/.my.cnf unless
+ * given on the command line.
+ *
+ * USAGE:
+ *   ./verify_embeddings [-H host] [-u user] [-p password] [-d database]
+ *                       [-t table] [-c column] [-k id_column] [-n dim]
+ *                       [-e tolerance] [-j threads] [-b batch_rows]
+ */
+
+#include <mysql.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#  include <immintrin.h>
+#endif
+
+/* Problem bits per row */
+enum {
+    BAD_NULL      = 1 << 0,
+    BAD_LENGTH    = 1 << 1,
+    BAD_NONFINITE = 1 << 2,
+    BAD_ZERO      = 1 << 3,
+    BAD_NORM      = 1 << 4,
+    BAD_DUPLICATE = 1 << 5,
+    BAD_KINDS     = 6
+};
+
+static const char *const bad_names[BAD_KINDS] = {
+    "null", "length", "nonfinite", "zero", "norm", "duplicate"
+};
+
+#define ROW_ALIGN   32          /* Each blob starts on a SIMD-friendly boundary */
+#define CHUNK_ROWS  256         /* Rows a worker claims at a time */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* =========================
+   Row checks
+   ========================= */
+
+/*
+ * Sum of squares and a NaN/Inf test in one pass: a float is not finite
+ * when all of its exponent bits are set.
+ */
+static float scan_vector(const float *v, int n, int *nonfinite) {
+    int i = 0;
+    float sumsq = 0.0f;
+    int bad = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256i exp_mask = _mm256_set1_epi32(0x7f800000);
+    __m256 acc = _mm256_setzero_ps();
+    __m256i flags = _mm256_setzero_si256();
+    for (; i <= n - 8; i += 8) {
+        __m256 x = _mm256_loadu_ps(v + i);
+        __m256i e = _mm256_and_si256(_mm256_castps_si256(x), exp_mask);
+        flags = _mm256_or_si256(flags, _mm256_cmpeq_epi32(e, exp_mask));
+        acc = _mm256_fmadd_ps(x, x, acc);
+    }
+    bad = !_mm256_testz_si256(flags, flags);
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    sumsq = _mm_cvtss_f32(s);
+#elif defined(__SSE4_1__)
+    const __m128i exp_mask = _mm_set1_epi32(0x7f800000);
+    __m128 acc = _mm_setzero_ps();
+    __m128i flags = _mm_setzero_si128();
+    for (; i <= n - 4; i += 4) {
+        __m128 x = _mm_loadu_ps(v + i);
+        __m128i e = _mm_and_si128(_mm_castps_si128(x), exp_mask);
+        flags = _mm_or_si128(flags, _mm_cmpeq_epi32(e, exp_mask));
+        acc = _mm_add_ps(acc, _mm_mul_ps(x, x));
+    }
+    bad = !_mm_testz_si128(flags, flags);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_movehdup_ps(acc));
+    sumsq = _mm_cvtss_f32(acc);
+#endif
+    for (; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, v + i, sizeof(bits));
+        if ((bits & 0x7f800000u) == 0x7f800000u) bad = 1;
+        sumsq += v[i] * v[i];
+    }
+    *nonfinite = bad;
+    return sumsq;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/* 64-bit hash over 8-byte words with a splitmix64 finish */
+static uint64_t hash_blob(const unsigned char *p, unsigned long len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    unsigned long i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        h = rotl64(h ^ (w * 0xBF58476D1CE4E5B9ULL), 29) * 0x94D049BB133111EBULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, len - i);
+    h ^= tail;
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h ? h : 1;       /* 0 marks an empty slot in the dedup table */
+}
+
+/* =========================
+   Batches and workers
+   ========================= */
+
+typedef struct {
+    int count;
+    int capacity;
+    long long *ids;
+    unsigned long *offsets;
+    unsigned long *lengths;
+    unsigned char *is_null;
+    char *data;
+    size_t data_len;
+    size_t data_cap;
+    /* Filled in by the workers */
+    unsigned char *status;
+    float *norms;
+    uint64_t *hashes;
+    int next;               /* Next unclaimed row (atomic) */
+} batch_t;
+
+typedef struct {
+    int dim;
+    double tolerance;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    batch_t *current;
+    unsigned long generation;
+    int busy;               /* Workers still on the current batch */
+    int quit;
+} pool_t;
+
+static void check_rows(const pool_t *pool, batch_t *b, int from, int to) {
+    for (int r = from; r < to; r++) {
+        unsigned char status = 0;
+        b->norms[r] = 0.0f;
+        b->hashes[r] = 0;
+        if (b->is_null[r]) {
+            b->status[r] = BAD_NULL;
+            continue;
+        }
+
+        unsigned long len = b->lengths[r];
+        const char *blob = b->data + b->offsets[r];
+        if (len == 0 || len % sizeof(float) != 0 || len / sizeof(float) != (unsigned long)pool->dim) {
+            b->status[r] = BAD_LENGTH;
+            continue;
+        }
+
+        int nonfinite;
+        float sumsq = scan_vector((const float *)blob, pool->dim, &nonfinite);
+        float norm = sqrtf(sumsq);
+        b->norms[r] = norm;
+        if (nonfinite) status |= BAD_NONFINITE;
+        else if (sumsq == 0.0f) status |= BAD_ZERO;
+        else if (pool->tolerance > 0.0 && fabs(norm - 1.0) > pool->tolerance) status |= BAD_NORM;
+        b->hashes[r] = hash_blob((const unsigned char *)blob, len);
+        b->status[r] = status;
+    }
+}
+
+static void *worker_main(void *arg) {
+    pool_t *pool = (pool_t *)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->work_ready, &pool->mutex);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        batch_t *b = pool->current;
+        pthread_mutex_unlock(&pool->mutex);
+
+        for (;;) {
+            int from = __atomic_fetch_add(&b->next, CHUNK_ROWS, __ATOMIC_RELAXED);
+            if (from >= b->count)
+                break;
+            int to = from + CHUNK_ROWS < b->count ? from + CHUNK_ROWS : b->count;
+            check_rows(pool, b, from, to);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static void pool_submit(pool_t *pool, batch_t *b, int nthreads) {
+    pthread_mutex_lock(&pool->mutex);
+    b->next = 0;
+    pool->current = b;
+    pool->busy = nthreads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void pool_wait(pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->work_done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void batch_init(batch_t *b, int capacity, size_t data_cap) {
+    memset(b, 0, sizeof(*b));
+    b->capacity = capacity;
+    b->ids = (long long *)malloc(sizeof(long long) * capacity);
+    b->offsets = (unsigned long *)malloc(sizeof(unsigned long) * capacity);
+    b->lengths = (unsigned long *)malloc(sizeof(unsigned long) * capacity);
+    b->is_null = (unsigned char *)malloc(capacity);
+    b->status = (unsigned char *)malloc(capacity);
+    b->norms = (float *)malloc(sizeof(float) * capacity);
+    b->hashes = (uint64_t *)malloc(sizeof(uint64_t) * capacity);
+    b->data_cap = data_cap;
+    b->data = (char *)aligned_alloc(ROW_ALIGN, data_cap);
+    if (!b->ids || !b->offsets || !b->lengths || !b->is_null || !b->status ||
+        !b->norms || !b->hashes || !b->data) {
+        fprintf(stderr, "verify_embeddings: out of memory\n");
+        exit(1);
+    }
+}
+
+/* Doubles the row capacity (the blob area grows on its own in batch_add) */
+static void batch_grow(batch_t *b) {
+    int capacity = b->capacity * 2;
+    b->ids = (long long *)realloc(b->ids, sizeof(long long) * capacity);
+    b->offsets = (unsigned long *)realloc(b->offsets, sizeof(unsigned long) * capacity);
+    b->lengths = (unsigned long *)realloc(b->lengths, sizeof(unsigned long) * capacity);
+    b->is_null = (unsigned char *)realloc(b->is_null, capacity);
+    b->status = (unsigned char *)realloc(b->status, capacity);
+    b->norms = (float *)realloc(b->norms, sizeof(float) * capacity);
+    b->hashes = (uint64_t *)realloc(b->hashes, sizeof(uint64_t) * capacity);
+    if (!b->ids || !b->offsets || !b->lengths || !b->is_null || !b->status ||
+        !b->norms || !b->hashes) {
+        fprintf(stderr, "verify_embeddings: out of memory\n");
+        exit(1);
+    }
+    b->capacity = capacity;
+}
+
+static void batch_add(batch_t *b, long long id, const char *blob, unsigned long len) {
+    int r = b->count++;
+    b->ids[r] = id;
+    b->is_null[r] = (blob == NULL);
+    b->lengths[r] = blob ? len : 0;
+    b->offsets[r] = b->data_len;
+    if (!blob)
+        return;
+
+    size_t need = b->data_len + ((len + ROW_ALIGN - 1) & ~(size_t)(ROW_ALIGN - 1));
+    if (need > b->data_cap) {
+        size_t cap = b->data_cap;
+        while (cap < need) cap *= 2;
+        char *data = (char *)aligned_alloc(ROW_ALIGN, cap);
+        if (!data) {
+            fprintf(stderr, "verify_embeddings: out of memory\n");
+            exit(1);
+        }
+        memcpy(data, b->data, b->data_len);
+        free(b->data);
+        b->data = data;
+        b->data_cap = cap;
+    }
+    memcpy(b->data + b->data_len, blob, len);
+    b->data_len = need;
+}
+
+/* =========================
+   Duplicate detection
+   ========================= */
+
+typedef struct {
+    uint64_t *keys;
+    long long *ids;
+    size_t mask;
+    size_t used;
+} dedup_t;
+
+static void dedup_init(dedup_t *d, size_t slots) {
+    d->keys = (uint64_t *)calloc(slots, sizeof(uint64_t));
+    d->ids = (long long *)malloc(sizeof(long long) * slots);
+    d->mask = slots - 1;
+    d->used = 0;
+    if (!d->keys || !d->ids) {
+        fprintf(stderr, "verify_embeddings: out of memory\n");
+        exit(1);
+    }
+}
+
+/* Returns 1 and the first id when the hash was already seen */
+static int dedup_insert(dedup_t *d, uint64_t key, long long id, long long *first) {
+    if ((d->used + 1) * 2 > d->mask + 1) {
+        dedup_t grown;
+        dedup_init(&grown, (d->mask + 1) * 2);
+        for (size_t i = 0; i <= d->mask; i++) {
+            if (!d->keys[i]) continue;
+            size_t j = d->keys[i] & grown.mask;
+            while (grown.keys[j]) j = (j + 1) & grown.mask;
+            grown.keys[j] = d->keys[i];
+            grown.ids[j] = d->ids[i];
+        }
+        grown.used = d->used;
+        free(d->keys);
+        free(d->ids);
+        *d = grown;
+    }
+
+    size_t i = key & d->mask;
+    while (d->keys[i]) {
+        if (d->keys[i] == key) {
+            *first = d->ids[i];
+            return 1;
+        }
+        i = (i + 1) & d->mask;
+    }
+    d->keys[i] = key;
+    d->ids[i] = id;
+    d->used++;
+    return 0;
+}
+
+/* =========================
+   Reporting
+   ========================= */
+
+typedef struct {
+    unsigned long long rows;
+    unsigned long long bytes;
+    unsigned long long counts[BAD_KINDS];
+    unsigned long long bad_rows;
+} totals_t;
+
+/* Runs on the reading thread, in table order, after the workers are done */
+static void report_batch(const pool_t *pool, batch_t *b, dedup_t *dedup, totals_t *totals) {
+    for (int r = 0; r < b->count; r++) {
+        unsigned char status = b->status[r];
+        long long first = 0;
+        if (b->hashes[r] && dedup_insert(dedup, b->hashes[r], b->ids[r], &first))
+            status |= BAD_DUPLICATE;
+
+        totals->rows++;
+        totals->bytes += b->lengths[r];
+        if (!status)
+            continue;
+        totals->bad_rows++;
+        for (int k = 0; k < BAD_KINDS; k++) {
+            if (!(status & (1 << k))) continue;
+            totals->counts[k]++;
+            printf("%lld\t%s\t", b->ids[r], bad_names[k]);
+            switch (1 << k) {
+            case BAD_LENGTH:
+                printf("%lu bytes, expected %d\n", b->lengths[r], pool->dim * (int)sizeof(float));
+                break;
+            case BAD_NORM:
+                printf("norm %.6f\n", b->norms[r]);
+                break;
+            case BAD_DUPLICATE:
+                printf("same as id %lld\n", first);
+                break;
+            default:
+                printf("-\n");
+                break;
+            }
+        }
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: verify_embeddings [-H host] [-u user] [-p password] [-d database]\n"
+        "                         [-t table] [-c column] [-k id_column] [-n dim]\n"
+        "                         [-e tolerance] [-j threads] [-b batch_rows]\n"
+        "  defaults: -d rag -t youtube_rag -c embedding -k id -e 0.001\n"
+        "            -n from the first valid row, -j online CPUs, -b 4096\n"
+        "  -e 0 disables the norm check\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *host = NULL, *user = NULL, *password = NULL, *database = "rag";
+    const char *table = "youtube_rag", *column = "embedding", *key = "id";
+    int dim = 0, nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN), batch_rows = 4096;
+    double tolerance = 1e-3;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:u:p:d:t:c:k:n:e:j:b:h")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'u': user = optarg; break;
+        case 'p': password = optarg; break;
+        case 'd': database = optarg; break;
+        case 't': table = optarg; break;
+        case 'c': column = optarg; break;
+        case 'k': key = optarg; break;
+        case 'n': dim = atoi(optarg); break;
+        case 'e': tolerance = atof(optarg); break;
+        case 'j': nthreads = atoi(optarg); break;
+        case 'b': batch_rows = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (nthreads < 1) nthreads = 1;
+    if (batch_rows < CHUNK_ROWS) batch_rows = CHUNK_ROWS;
+
+    MYSQL *conn = mysql_init(NULL);
+    if (!conn) {
+        fprintf(stderr, "verify_embeddings: mysql_init failed\n");
+        return 1;
+    }
+    mysql_options(conn, MYSQL_READ_DEFAULT_GROUP, "client");
+    if (!mysql_real_connect(conn, host, user, password, database, 0, NULL, 0)) {
+        fprintf(stderr, "verify_embeddings: %s\n", mysql_error(conn));
+        return 1;
+    }
+
+    char sql[512];
+    snprintf(sql, sizeof(sql), "SELECT `%s`, `%s` FROM `%s`", key, column, table);
+    if (mysql_real_query(conn, sql, strlen(sql)) != 0) {
+        fprintf(stderr, "verify_embeddings: %s\n", mysql_error(conn));
+        mysql_close(conn);
+        return 1;
+    }
+    /* Unbuffered: rows come off the socket as we fetch them */
+    MYSQL_RES *res = mysql_use_result(conn);
+    if (!res) {
+        fprintf(stderr, "verify_embeddings: %s\n", mysql_error(conn));
+        mysql_close(conn);
+        return 1;
+    }
+
+    pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.dim = dim;
+    pool.tolerance = tolerance;
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.work_ready, NULL);
+    pthread_cond_init(&pool.work_done, NULL);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * nthreads);
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, worker_main, &pool);
+
+    /* Two batches: the workers check one while the other is being read */
+    batch_t batches[2];
+    batch_init(&batches[0], batch_rows, (size_t)batch_rows * 1600);
+    batch_init(&batches[1], batch_rows, (size_t)batch_rows * 1600);
+    batch_t *filling = &batches[0], *checking = NULL;
+
+    dedup_t dedup;
+    dedup_init(&dedup, 1 << 16);
+    totals_t totals;
+    memset(&totals, 0, sizeof(totals));
+
+    double start = now_sec();
+    MYSQL_ROW row;
+    int eof = 0;
+    while (!eof) {
+        row = mysql_fetch_row(res);
+        if (row) {
+            unsigned long *lengths = mysql_fetch_lengths(res);
+            if (pool.dim == 0 && row[1] && lengths[1] && lengths[1] % sizeof(float) == 0) {
+                pool.dim = (int)(lengths[1] / sizeof(float));
+                fprintf(stderr, "dimension %d (from the first valid row)\n", pool.dim);
+            }
+            batch_add(filling, row[0] ? strtoll(row[0], NULL, 10) : 0, row[1], lengths[1]);
+            /* Nothing is submitted before the dimension is known, and it
+               never changes afterwards: the first batch grows until a
+               valid row shows up */
+            if (pool.dim == 0 && filling->count == filling->capacity)
+                batch_grow(filling);
+            if (filling->count < filling->capacity)
+                continue;
+        } else {
+            eof = 1;
+            if (mysql_errno(conn)) {
+                fprintf(stderr, "verify_embeddings: %s\n", mysql_error(conn));
+                return 1;
+            }
+        }
+
+        if (checking) {
+            pool_wait(&pool);
+            report_batch(&pool, checking, &dedup, &totals);
+        }
+        if (filling->count > 0 && pool.dim == 0) {
+            fprintf(stderr, "verify_embeddings: no row has a float32 vector to take the dimension from; pass -n\n");
+            return 1;
+        }
+        if (filling->count > 0) {
+            pool_submit(&pool, filling, nthreads);
+            checking = filling;
+            filling = (filling == &batches[0]) ? &batches[1] : &batches[0];
+            filling->count = 0;
+            filling->data_len = 0;
+        } else {
+            checking = NULL;
+        }
+    }
+    if (checking) {
+        pool_wait(&pool);
+        report_batch(&pool, checking, &dedup, &totals);
+    }
+    double elapsed = now_sec() - start;
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.work_ready);
+    pthread_mutex_unlock(&pool.mutex);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    mysql_free_result(res);
+    mysql_close(conn);
+
+    fflush(stdout);
+    fprintf(stderr, "%llu rows, %.1f MB in %.2f s (%.0f rows/s, %.1f MB/s, %d threads)\n",
+            totals.rows, totals.bytes / 1e6, elapsed,
+            elapsed > 0 ? totals.rows / elapsed : 0.0,
+            elapsed > 0 ? totals.bytes / 1e6 / elapsed : 0.0, nthreads);
+    fprintf(stderr, "%llu rows with problems:", totals.bad_rows);
+    for (int k = 0; k < BAD_KINDS; k++)
+        fprintf(stderr, " %s %llu%s", bad_names[k], totals.counts[k], k + 1 < BAD_KINDS ? "," : "\n");
+
+    return totals.bad_rows ? 2 : 0;
+}